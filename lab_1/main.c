@@ -2,94 +2,546 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <stddef.h>
 #include <ctype.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/resource.h>
 
-void inverse(const uint8_t *input, int channels, int w, int h, uint8_t *output) {
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+/* Side of the square tiles of the rotations in pixels, a multiple of 16 for the SIMD transposition */
+#define ROTATE_TILE_SIZE 64
+
+/* Length of the sequence of transforms in the arguments */
+#define MAX_TRANSFORMS_NUMBER 64
+
+/* Size of the bands of rows of the streaming mode */
+#define STREAM_BUFFER_SIZE (1 << 20)
+
+typedef void (*row_function)(const uint8_t *input, uint8_t *output, int channels, int w);
+
+/*
+ * Rows [0, rows_number) of the band, processed by one thread.
+ */
+typedef struct rows_band {
+    row_function function;
+    const uint8_t *input;
+    uint8_t *output;
+    int channels;
+    int w;
+    int rows_number;
+} rows_band;
+
+void *process_band(void *arg) {
+    rows_band *band = (rows_band *) arg;
+    size_t row_size = (size_t) band->channels * band->w;
+    int i;
+    for (i = 0; i < band->rows_number; ++i) {
+        band->function(band->input + i * row_size, band->output + i * row_size, band->channels, band->w);
+    }
+    return NULL;
+}
+
+/*
+ * Splits the image into horizontal bands of equal height, one per thread. The calling thread processes the first
+ * band, and the bands of the threads which couldn't be started are processed by it too.
+ */
+void process_by_bands(row_function function, const uint8_t *input, int channels, int w, int h, uint8_t *output,
+                      int threads_number) {
+    size_t row_size = (size_t) channels * w;
+    rows_band *bands;
+    pthread_t *threads;
+    int *started;
     int i;
-    for (i = 0; i < channels * w * h; ++i) {
+
+    if (threads_number > h) {
+        threads_number = h;
+    }
+    bands = (rows_band *) malloc(threads_number * sizeof(rows_band));
+    threads = (pthread_t *) malloc(threads_number * sizeof(pthread_t));
+    started = (int *) calloc(threads_number, sizeof(int));
+    if (!bands || !threads || !started) {
+        rows_band band;
+        band.function = function;
+        band.input = input;
+        band.output = output;
+        band.channels = channels;
+        band.w = w;
+        band.rows_number = h;
+        process_band(&band);
+        goto end;
+    }
+
+    for (i = 0; i < threads_number; ++i) {
+        int row_begin = (int) ((int64_t) h * i / threads_number);
+        int row_end = (int) ((int64_t) h * (i + 1) / threads_number);
+        bands[i].function = function;
+        bands[i].input = input + row_begin * row_size;
+        bands[i].output = output + row_begin * row_size;
+        bands[i].channels = channels;
+        bands[i].w = w;
+        bands[i].rows_number = row_end - row_begin;
+        if (i != 0) {
+            started[i] = pthread_create(&threads[i], NULL, process_band, &bands[i]) == 0;
+        }
+    }
+    process_band(&bands[0]);
+    for (i = 1; i < threads_number; ++i) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        } else {
+            process_band(&bands[i]);
+        }
+    }
+
+    end:
+    free(bands);
+    free(threads);
+    free(started);
+}
+
+void inverse_row(const uint8_t *input, uint8_t *output, int channels, int w) {
+    size_t size = (size_t) channels * w;
+    size_t i = 0;
+#ifdef __AVX2__
+    __m256i ones = _mm256_set1_epi8(-1);
+    for (; i + 32 <= size; i += 32) {
+        __m256i data = _mm256_loadu_si256((const __m256i *) (input + i));
+        _mm256_storeu_si256((__m256i *) (output + i), _mm256_xor_si256(data, ones));
+    }
+#elif defined(__SSE2__)
+    __m128i ones = _mm_set1_epi8(-1);
+    for (; i + 16 <= size; i += 16) {
+        __m128i data = _mm_loadu_si128((const __m128i *) (input + i));
+        _mm_storeu_si128((__m128i *) (output + i), _mm_xor_si128(data, ones));
+    }
+#endif
+    for (; i < size; ++i) {
         output[i] = UINT8_MAX - input[i];
     }
 }
 
-void reflect_hor(const uint8_t *input, int channels, int w, int h, uint8_t *output) {
-    int i, j, c;
+void inverse(const uint8_t *input, int channels, int w, int h, uint8_t *output, int threads_number) {
+    process_by_bands(inverse_row, input, channels, w, h, output, threads_number);
+}
+
+#ifdef __SSSE3__
+/*
+ * Writes the 16 pixels of the block in the reverse order with byte shuffles. The 48 bytes of 16 RGB pixels are spread
+ * over 3 registers, so every output register is assembled from the shuffles of the 2 or 3 input registers it takes
+ * the bytes from. The input is loaded before the output is stored, so they may be the same block.
+ */
+void reverse_block(const uint8_t *input, uint8_t *output, int channels) {
+    if (channels == 1) {
+        __m128i reverse = _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+        _mm_storeu_si128((__m128i *) output, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) input), reverse));
+    } else {
+        __m128i mask_0_1 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 14);
+        __m128i mask_0_2 = _mm_setr_epi8(13, 14, 15, 10, 11, 12, 7, 8, 9, 4, 5, 6, 1, 2, 3, -1);
+        __m128i mask_1_0 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 15, -1);
+        __m128i mask_1_1 = _mm_setr_epi8(15, -1, 11, 12, 13, 8, 9, 10, 5, 6, 7, 2, 3, 4, -1, 0);
+        __m128i mask_1_2 = _mm_setr_epi8(-1, 0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+        __m128i mask_2_0 = _mm_setr_epi8(-1, 12, 13, 14, 9, 10, 11, 6, 7, 8, 3, 4, 5, 0, 1, 2);
+        __m128i mask_2_1 = _mm_setr_epi8(1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+        __m128i data_0 = _mm_loadu_si128((const __m128i *) input);
+        __m128i data_1 = _mm_loadu_si128((const __m128i *) (input + 16));
+        __m128i data_2 = _mm_loadu_si128((const __m128i *) (input + 32));
+        _mm_storeu_si128((__m128i *) output,
+                         _mm_or_si128(_mm_shuffle_epi8(data_1, mask_0_1), _mm_shuffle_epi8(data_2, mask_0_2)));
+        _mm_storeu_si128((__m128i *) (output + 16),
+                         _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(data_0, mask_1_0),
+                                                   _mm_shuffle_epi8(data_1, mask_1_1)),
+                                      _mm_shuffle_epi8(data_2, mask_1_2)));
+        _mm_storeu_si128((__m128i *) (output + 32),
+                         _mm_or_si128(_mm_shuffle_epi8(data_0, mask_2_0), _mm_shuffle_epi8(data_1, mask_2_1)));
+    }
+}
+#endif
+
+/*
+ * Writes the pixels of the row in the reverse order, taking the blocks of 16 pixels from the end of the input row.
+ */
+void reflect_row(const uint8_t *input, uint8_t *output, int channels, int w) {
+    int j = 0;
+    int c;
+#ifdef __SSSE3__
+    for (; j + 16 <= w; j += 16) {
+        reverse_block(input + channels * (w - j - 16), output + channels * j, channels);
+    }
+#endif
+    for (; j < w; ++j) {
+        for (c = 0; c < channels; ++c) {
+            output[channels * j + c] = input[channels * (w - 1 - j) + c];
+        }
+    }
+}
+
+void reflect_hor(const uint8_t *input, int channels, int w, int h, uint8_t *output, int threads_number) {
+    process_by_bands(reflect_row, input, channels, w, h, output, threads_number);
+}
+
+void reflect_vert(const uint8_t *input, int channels, int w, int h, uint8_t *output) {
+    size_t row_size = (size_t) channels * w;
+    int i;
     for (i = 0; i < h; ++i) {
-        for (j = 0; j < w; ++j) {
-            for (c = 0; c < channels; ++c) {
-                output[i * (channels * w) + channels * j + c] = input[i * (channels * w) + channels * (w - 1 - j) + c];
+        memcpy(output + i * row_size, input + (h - 1 - i) * row_size, row_size);
+    }
+}
+
+void rotate_180(const uint8_t *input, int channels, int w, int h, uint8_t *output) {
+    size_t row_size = (size_t) channels * w;
+    int i;
+    for (i = 0; i < h; ++i) {
+        reflect_row(input + (h - 1 - i) * row_size, output + i * row_size, channels, w);
+    }
+}
+
+#ifdef __SSE2__
+/*
+ * Transposes the 16x16 bytes block in the registers. Every round interleaves the rows i and i + 8, which rotates
+ * the 8 bits of the (row, column) position by one, so after 4 rounds the row and the column are swapped.
+ */
+void transpose_16x16(const uint8_t *input, ptrdiff_t in_stride, uint8_t *output, ptrdiff_t out_stride) {
+    __m128i rows[16], interleaved[16];
+    int i, round;
+    for (i = 0; i < 16; ++i) {
+        rows[i] = _mm_loadu_si128((const __m128i *) (input + i * in_stride));
+    }
+    for (round = 0; round < 4; ++round) {
+        for (i = 0; i < 8; ++i) {
+            interleaved[2 * i] = _mm_unpacklo_epi8(rows[i], rows[i + 8]);
+            interleaved[2 * i + 1] = _mm_unpackhi_epi8(rows[i], rows[i + 8]);
+        }
+        memcpy(rows, interleaved, sizeof(rows));
+    }
+    for (i = 0; i < 16; ++i) {
+        _mm_storeu_si128((__m128i *) (output + i * out_stride), rows[i]);
+    }
+}
+#endif
+
+/*
+ * Output pixels [i_begin, i_end) x [j_begin, j_end) of a transposition, where the output pixel (i, j) is
+ * the input pixel origin + i * pixel_step + j * row_step.
+ */
+void rotate_tile_1(const uint8_t *origin, ptrdiff_t pixel_step, ptrdiff_t row_step, uint8_t *output, size_t out_stride,
+                   int i_begin, int i_end, int j_begin, int j_end) {
+    int i, j;
+#ifdef __SSE2__
+    if (i_end - i_begin == ROTATE_TILE_SIZE && j_end - j_begin == ROTATE_TILE_SIZE) {
+        /* The mirrored columns read the input rows backwards, so the rows of the block are stored backwards */
+        int last = pixel_step < 0 ? 15 : 0;
+        for (i = i_begin; i < i_end; i += 16) {
+            for (j = j_begin; j < j_end; j += 16) {
+                transpose_16x16(origin + (i + last) * pixel_step + j * row_step, row_step,
+                                output + (i + last) * out_stride + j,
+                                last ? -(ptrdiff_t) out_stride : (ptrdiff_t) out_stride);
             }
         }
+        return;
+    }
+#endif
+    for (i = i_begin; i < i_end; ++i) {
+        const uint8_t *in = origin + i * pixel_step + j_begin * row_step;
+        uint8_t *out = output + i * out_stride + j_begin;
+        for (j = j_begin; j < j_end; ++j) {
+            *out++ = *in;
+            in += row_step;
+        }
     }
 }
 
-void reflect_vert(const uint8_t *input, int channels, int w, int h, uint8_t *output) {
+void rotate_tile_3(const uint8_t *origin, ptrdiff_t pixel_step, ptrdiff_t row_step, uint8_t *output, size_t out_stride,
+                   int i_begin, int i_end, int j_begin, int j_end) {
     int i, j;
-    for (i = 0; i < h; ++i) {
-        for (j = 0; j < channels * w; ++j) {
-            output[i * (channels * w) + j] = input[(h - 1 - i) * (channels * w) + j];
+    for (i = i_begin; i < i_end; ++i) {
+        const uint8_t *in = origin + i * pixel_step + j_begin * row_step;
+        uint8_t *out = output + i * out_stride + 3 * j_begin;
+        for (j = j_begin; j < j_end; ++j) {
+            out[0] = in[0];
+            out[1] = in[1];
+            out[2] = in[2];
+            out += 3;
+            in += row_step;
         }
     }
 }
 
-void rotate_right(const uint8_t *input, int channels, int w, int h, uint8_t *output) {
-    int i, j, c;
-    for (i = 0; i < w; ++i) {
-        for (j = 0; j < h; ++j) {
-            for (c = 0; c < channels; ++c) {
-                output[i * (channels * h) + channels * j + c] = input[(h - 1 - j) * (channels * w) + channels * i + c];
+/*
+ * Transposes the image, mirroring the columns and the rows of the input, which gives the rotations, the transposition
+ * and the transposition over the other diagonal: the output pixel (i, j) is the input pixel of the column i
+ * and the row j, or w - 1 - i and h - 1 - j when mirrored.
+ * The output is written by square tiles: reading a whole input column for every output row touches a new cache line
+ * and, on wide images, a new page for every pixel, while the rows of a tile stay in the cache.
+ */
+void transpose(const uint8_t *input, int channels, int w, int h, uint8_t *output, int mirrored_x, int mirrored_y) {
+    ptrdiff_t in_stride = (ptrdiff_t) channels * w;
+    size_t out_stride = (size_t) channels * h;
+    ptrdiff_t pixel_step = mirrored_x ? -channels : channels;
+    ptrdiff_t row_step = mirrored_y ? -in_stride : in_stride;
+    const uint8_t *origin = input + (mirrored_x ? (ptrdiff_t) channels * (w - 1) : 0) +
+                            (mirrored_y ? (h - 1) * in_stride : 0);
+    int i, j;
+
+    for (i = 0; i < w; i += ROTATE_TILE_SIZE) {
+        for (j = 0; j < h; j += ROTATE_TILE_SIZE) {
+            int i_end = i + ROTATE_TILE_SIZE < w ? i + ROTATE_TILE_SIZE : w;
+            int j_end = j + ROTATE_TILE_SIZE < h ? j + ROTATE_TILE_SIZE : h;
+            if (channels == 1) {
+                rotate_tile_1(origin, pixel_step, row_step, output, out_stride, i, i_end, j, j_end);
+            } else {
+                rotate_tile_3(origin, pixel_step, row_step, output, out_stride, i, i_end, j, j_end);
             }
         }
     }
 }
 
-void rotate_left(const uint8_t *input, int channels, int w, int h, uint8_t *output) {
-    int i, j, c;
-    for (i = 0; i < w; ++i) {
-        for (j = 0; j < h; ++j) {
-            for (c = 0; c < channels; ++c) {
-                output[i * (channels * h) + channels * j + c] = input[j * (channels * w) + channels * (w - 1 - i) + c];
+/*
+ * In-place transforms, the output overwrites the input, so only one copy of the image is kept in memory.
+ */
+
+void reflect_row_in_place(const uint8_t *input, uint8_t *output, int channels, int w) {
+    uint8_t pixel[3];
+    int j = 0;
+#ifdef __SSSE3__
+    uint8_t block[48];
+    for (; 2 * (j + 16) <= w; j += 16) {
+        uint8_t *left = output + channels * j;
+        uint8_t *right = output + channels * (w - j - 16);
+        reverse_block(left, block, channels);
+        reverse_block(right, left, channels);
+        memcpy(right, block, 16 * channels);
+    }
+#endif
+    (void) input; /* The same row as the output */
+    for (; j < w - 1 - j; ++j) {
+        memcpy(pixel, output + channels * j, channels);
+        memcpy(output + channels * j, output + channels * (w - 1 - j), channels);
+        memcpy(output + channels * (w - 1 - j), pixel, channels);
+    }
+}
+
+void reflect_hor_in_place(uint8_t *data, int channels, int w, int h, int threads_number) {
+    process_by_bands(reflect_row_in_place, data, channels, w, h, data, threads_number);
+}
+
+/*
+ * Swaps the rows through a small buffer, by parts of its size.
+ */
+void reflect_vert_in_place(uint8_t *data, int channels, int w, int h) {
+    size_t row_size = (size_t) channels * w;
+    uint8_t buffer[4096];
+    int i;
+    for (i = 0; i < h / 2; ++i) {
+        uint8_t *top = data + i * row_size;
+        uint8_t *bottom = data + (h - 1 - i) * row_size;
+        size_t offset;
+        for (offset = 0; offset < row_size; offset += sizeof(buffer)) {
+            size_t size = row_size - offset < sizeof(buffer) ? row_size - offset : sizeof(buffer);
+            memcpy(buffer, top + offset, size);
+            memcpy(top + offset, bottom + offset, size);
+            memcpy(bottom + offset, buffer, size);
+        }
+    }
+}
+
+/*
+ * Transposes the w x h image into the h x w one. The square image swaps the pixels across the diagonal by tiles.
+ * In the other images the pixel at the position k moves to k * h mod (w * h - 1), and the positions form
+ * cycles which are rotated one by one, with a bit per pixel to mark the moved ones.
+ */
+int transpose_in_place(uint8_t *data, int channels, int w, int h) {
+    uint8_t pixel[3], moved_pixel[3];
+    uint8_t *moved;
+    uint64_t last, start, k;
+    int i0, j0, i, j;
+
+    if (w == h) {
+        for (i0 = 0; i0 < w; i0 += ROTATE_TILE_SIZE) {
+            for (j0 = i0; j0 < w; j0 += ROTATE_TILE_SIZE) {
+                int i_end = i0 + ROTATE_TILE_SIZE < w ? i0 + ROTATE_TILE_SIZE : w;
+                int j_end = j0 + ROTATE_TILE_SIZE < w ? j0 + ROTATE_TILE_SIZE : w;
+                for (i = i0; i < i_end; ++i) {
+                    for (j = i0 == j0 ? i + 1 : j0; j < j_end; ++j) {
+                        uint8_t *a = data + ((size_t) i * w + j) * channels;
+                        uint8_t *b = data + ((size_t) j * w + i) * channels;
+                        memcpy(pixel, a, channels);
+                        memcpy(a, b, channels);
+                        memcpy(b, pixel, channels);
+                    }
+                }
             }
         }
+        return 0;
+    }
+
+    last = (uint64_t) w * h - 1;
+    moved = (uint8_t *) calloc(last / 8 + 1, sizeof(uint8_t));
+    if (!moved) {
+        fprintf(stderr, "Couldn't allocate memory for the in-place transposition.\n");
+        return -1;
+    }
+    /* The first and the last pixels stay in place */
+    for (start = 1; start < last; ++start) {
+        if (moved[start / 8] & (1 << (start % 8))) {
+            continue;
+        }
+        memcpy(pixel, data + start * channels, channels);
+        k = start;
+        do {
+            k = k * h % last;
+            memcpy(moved_pixel, data + k * channels, channels);
+            memcpy(data + k * channels, pixel, channels);
+            memcpy(pixel, moved_pixel, channels);
+            moved[k / 8] |= 1 << (k % 8);
+        } while (k != start);
     }
+    free(moved);
+    return 0;
 }
 
-int transform(int channels, int transform_type,
-              uint8_t *input_data, int in_width, int in_height,
-              uint8_t *output_data, int *out_width, int *out_height) {
-    switch (transform_type) {
-        case 0:
-            inverse(input_data, channels, in_width, in_height, output_data);
-            *out_width = in_width;
-            *out_height = in_height;
-            break;
-        case 1:
-            reflect_hor(input_data, channels, in_width, in_height, output_data);
-            *out_width = in_width;
-            *out_height = in_height;
-            break;
-        case 2:
-            reflect_vert(input_data, channels, in_width, in_height, output_data);
-            *out_width = in_width;
-            *out_height = in_height;
-            break;
-        case 3:
-            rotate_right(input_data, channels, in_width, in_height, output_data);
-            *out_width = in_height;
-            *out_height = in_width;
-            break;
-        case 4:
-            rotate_left(input_data, channels, in_width, in_height, output_data);
-            *out_width = in_height;
-            *out_height = in_width;
-            break;
-        default:
+/*
+ * One of the 8 orientations of the image, the elements of the dihedral group. The output pixel (x, y) is the input
+ * pixel (x, y), or (y, x) when transposed, with the input column x mirrored to w - 1 - x and the row y to h - 1 - y.
+ */
+typedef struct orientation {
+    int transposed;
+    int mirrored_x;
+    int mirrored_y;
+} orientation;
+
+int get_orientation(int transform_type, orientation *result) {
+    /* The mirror, the vertical flip, the rotations to the right and to the left */
+    static const orientation orientations[] = {{0, 1, 0}, {0, 0, 1}, {1, 0, 1}, {1, 1, 0}};
+    if (transform_type < 1 || transform_type > 4) {
+        return -1;
+    }
+    *result = orientations[transform_type - 1];
+    return 0;
+}
+
+/*
+ * The orientation of applying the first one and then the second one. The mirrorings of the second orientation
+ * are applied to the coordinates of the first output, which are swapped in the input when the first is transposed.
+ */
+orientation compose_orientations(orientation first, orientation second) {
+    orientation result;
+    result.transposed = first.transposed ^ second.transposed;
+    result.mirrored_x = first.mirrored_x ^ (first.transposed ? second.mirrored_y : second.mirrored_x);
+    result.mirrored_y = first.mirrored_y ^ (first.transposed ? second.mirrored_x : second.mirrored_y);
+    return result;
+}
+
+void orient(const uint8_t *input, int channels, int w, int h, uint8_t *output, orientation target,
+            int threads_number) {
+    if (target.transposed) {
+        transpose(input, channels, w, h, output, target.mirrored_x, target.mirrored_y);
+    } else if (target.mirrored_x && target.mirrored_y) {
+        rotate_180(input, channels, w, h, output);
+    } else if (target.mirrored_x) {
+        reflect_hor(input, channels, w, h, output, threads_number);
+    } else if (target.mirrored_y) {
+        reflect_vert(input, channels, w, h, output);
+    }
+}
+
+/*
+ * The transposed orientations are the transposition followed by the mirroring of the transposed image,
+ * with the columns of the input being its rows.
+ */
+int orient_in_place(uint8_t *data, int channels, int w, int h, orientation target, int threads_number) {
+    if (target.transposed) {
+        int mirrored_x = target.mirrored_x;
+        int in_width = w;
+        if (transpose_in_place(data, channels, w, h) < 0) {
+            return -1;
+        }
+        target.mirrored_x = target.mirrored_y;
+        target.mirrored_y = mirrored_x;
+        w = h;
+        h = in_width;
+    }
+    if (target.mirrored_x) {
+        reflect_hor_in_place(data, channels, w, h, threads_number);
+    }
+    if (target.mirrored_y) {
+        reflect_vert_in_place(data, channels, w, h);
+    }
+    return 0;
+}
+
+/*
+ * Reduces the sequence of transforms to one orientation and, as the inversion commutes with them, to its parity.
+ */
+int reduce_transforms(const int *transform_types, int transforms_number, orientation *target, int *inverted) {
+    int i;
+
+    target->transposed = 0;
+    target->mirrored_x = 0;
+    target->mirrored_y = 0;
+    *inverted = 0;
+    for (i = 0; i < transforms_number; ++i) {
+        orientation next;
+        if (transform_types[i] == 0) {
+            *inverted ^= 1;
+        } else if (get_orientation(transform_types[i], &next) == 0) {
+            *target = compose_orientations(*target, next);
+        } else {
             fprintf(stderr, "Incorrect transform type %d. Must be less than 5 and greater than or equal to 0.\n",
-                    transform_type);
+                    transform_types[i]);
             return -1;
+        }
     }
     return 0;
 }
 
+/*
+ * Applies the sequence of transforms in one pass over the image. The result is the output data, or the input data
+ * which is left as is for the identity, and the transforms are in place when they are the same.
+ */
+int transform(int channels, const int *transform_types, int transforms_number,
+              uint8_t *input_data, int in_width, int in_height,
+              uint8_t *output_data, uint8_t **result_data, int *out_width, int *out_height, int threads_number) {
+    orientation target;
+    int inverted;
+
+    if (reduce_transforms(transform_types, transforms_number, &target, &inverted) < 0) {
+        return -1;
+    }
+
+    *out_width = target.transposed ? in_height : in_width;
+    *out_height = target.transposed ? in_width : in_height;
+    if (!target.transposed && !target.mirrored_x && !target.mirrored_y) {
+        *result_data = inverted ? output_data : input_data;
+        if (inverted) {
+            inverse(input_data, channels, in_width, in_height, output_data, threads_number);
+        }
+        return 0;
+    }
+
+    if (input_data == output_data) {
+        if (orient_in_place(input_data, channels, in_width, in_height, target, threads_number) < 0) {
+            return -1;
+        }
+    } else {
+        orient(input_data, channels, in_width, in_height, output_data, target, threads_number);
+    }
+    if (inverted) {
+        inverse(output_data, channels, *out_width, *out_height, output_data, threads_number);
+    }
+    *result_data = output_data;
+    return 0;
+}
+
 int read_header(FILE *file, char *file_name, char *file_type, int *channels,
                 int *width, int *height, int *max_value) {
     int c;
@@ -156,69 +608,240 @@ int write_data(FILE *file, char *file_name, uint8_t *data, size_t data_size) {
     return 0;
 }
 
+int read_data_at(int fd, char *file_name, uint8_t *data, size_t data_size, off_t offset) {
+    while (data_size > 0) {
+        ssize_t read_bytes = pread(fd, data, data_size, offset);
+        if (read_bytes <= 0) {
+            fprintf(stderr, "Couldn't read the input file data from the file \"%s\".\n", file_name);
+            return -1;
+        }
+        data += read_bytes;
+        data_size -= read_bytes;
+        offset += read_bytes;
+    }
+    return 0;
+}
+
+/*
+ * Transforms the image by bands of rows, so only one band is kept in memory, which works for the orientations
+ * keeping the pixels in their rows. The bands are read in the order of the file, so the input may be a pipe,
+ * except for the mirrored rows: then the bands are read from the end of the file with pread,
+ * which needs the input to be a regular file.
+ */
+int transform_stream(FILE *input_file, char *input_file_name, FILE *output_file, char *output_file_name,
+                     int channels, int w, int h, orientation target, int inverted) {
+    size_t row_size = (size_t) channels * w;
+    int band_rows = row_size < STREAM_BUFFER_SIZE ? (int) (STREAM_BUFFER_SIZE / row_size) : 1;
+    uint8_t *band = NULL;
+    long data_offset = 0;
+    int row, i;
+    int ret = 0;
+
+    if (band_rows > h) {
+        band_rows = h;
+    }
+    if (target.mirrored_y) {
+        data_offset = ftell(input_file);
+        if (data_offset < 0) {
+            fprintf(stderr, "The input file \"%s\" must be a regular file to be flipped vertically in the stream.\n",
+                    input_file_name);
+            goto fail;
+        }
+    }
+    band = (uint8_t *) malloc(band_rows * row_size);
+    if (!band) {
+        fprintf(stderr, "Couldn't allocate memory for the rows of the input file \"%s\".\n", input_file_name);
+        goto fail;
+    }
+
+    for (row = 0; row < h; row += band_rows) {
+        int rows_number = h - row < band_rows ? h - row : band_rows;
+        if (target.mirrored_y) {
+            /* The output rows [row, row + rows_number) are the input rows before h - row, in the reverse order */
+            if (read_data_at(fileno(input_file), input_file_name, band, rows_number * row_size,
+                             data_offset + (off_t) (h - row - rows_number) * row_size) < 0) {
+                goto fail;
+            }
+        } else if (read_data(input_file, input_file_name, band, rows_number * row_size) < 0) {
+            goto fail;
+        }
+        for (i = 0; i < rows_number; ++i) {
+            uint8_t *data = band + (target.mirrored_y ? rows_number - 1 - i : i) * row_size;
+            if (target.mirrored_x) {
+                reflect_row_in_place(data, data, channels, w);
+            }
+            if (inverted) {
+                inverse_row(data, data, channels, w);
+            }
+            if (write_data(output_file, output_file_name, data, row_size) < 0) {
+                goto fail;
+            }
+        }
+    }
+
+    goto end;
+
+    fail:
+    ret = -1;
+
+    end:
+    free(band);
+    return ret;
+}
+
+int parse_args(int argv, char **argc, int *threads_number, int *in_place, int *stream, int *print_memory,
+               char **input_file_name, char **output_file_name, int *transform_types, int *transforms_number) {
+    const char *sequence;
+    char *end;
+    int option;
+
+    *threads_number = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (*threads_number <= 0) {
+        *threads_number = 1;
+    }
+    *in_place = 0;
+    *stream = 0;
+    *print_memory = 0;
+    while ((option = getopt(argv, argc, "t:ism")) != -1) {
+        if (option == 't') {
+            *threads_number = atoi(optarg);
+            if (*threads_number <= 0) {
+                fprintf(stderr, "Incorrect number of threads \"%s\". Must be more than 0.\n", optarg);
+                return -1;
+            }
+        } else if (option == 'i') {
+            *in_place = 1;
+        } else if (option == 's') {
+            *stream = 1;
+        } else if (option == 'm') {
+            *print_memory = 1;
+        } else {
+            goto fail;
+        }
+    }
+    if (argv - optind != 3) {
+        fprintf(stderr, "Incorrect arguments format.\n");
+        goto fail;
+    }
+    *input_file_name = argc[optind];
+    *output_file_name = argc[optind + 1];
+    /* The transforms are applied in the order of the comma-separated list */
+    sequence = argc[optind + 2];
+    *transforms_number = 0;
+    do {
+        if (*transforms_number == MAX_TRANSFORMS_NUMBER) {
+            fprintf(stderr, "Too many transforms. Must be at most %d.\n", MAX_TRANSFORMS_NUMBER);
+            return -1;
+        }
+        transform_types[(*transforms_number)++] = (int) strtol(sequence, &end, 10);
+        if (end == sequence || (*end != ',' && *end != '\0')) {
+            fprintf(stderr, "Incorrect transform types \"%s\".\n", argc[optind + 2]);
+            goto fail;
+        }
+        sequence = end + 1;
+    } while (*end == ',');
+    return 0;
+
+    fail:
+    fprintf(stderr, "Usage: %s [-t threads_number] [-i] [-s] [-m] <input_file_name|-> <output_file_name|-> "
+                    "<transform_type[,transform_type...]>\n", argc[0]);
+    return -1;
+}
+
 int main(int argv, char **argc) {
     FILE *input_file = NULL;
     FILE *output_file = NULL;
-    int transform_type;
+    char *input_file_name;
+    char *output_file_name;
+    int transform_types[MAX_TRANSFORMS_NUMBER];
+    int transforms_number;
+    int threads_number;
+    int in_place, stream, print_memory;
     char file_type[3];
     int in_width, in_height, max_value;
     int out_width, out_height;
     int channels;
     uint8_t *input_data = NULL;
     uint8_t *output_data = NULL;
+    uint8_t *result_data;
     size_t data_size;
     int ret = 0;
 
-    if (argv != 4) {
-        fprintf(stderr, "Incorrect arguments format.\n"
-                        "Usage: %s <input_file_name> <output_file_name> <transform_type>\n", argc[0]);
+    if (parse_args(argv, argc, &threads_number, &in_place, &stream, &print_memory,
+                   &input_file_name, &output_file_name, transform_types, &transforms_number) < 0) {
         goto fail;
     }
 
-    input_file = fopen(argc[1], "rb");
+    input_file = strcmp(input_file_name, "-") == 0 ? stdin : fopen(input_file_name, "rb");
     if (!input_file) {
-        fprintf(stderr, "Couldn't open the input file \"%s\".\n", argc[1]);
+        fprintf(stderr, "Couldn't open the input file \"%s\".\n", input_file_name);
         goto fail;
     }
 
-    if (read_header(input_file, argc[1], file_type, &channels, &in_width, &in_height, &max_value) < 0) {
+    if (read_header(input_file, input_file_name, file_type, &channels, &in_width, &in_height, &max_value) < 0) {
         goto fail;
     }
 
-    data_size = channels * in_width * in_height * sizeof(uint8_t);
+    if (stream) {
+        orientation target;
+        int inverted;
+        if (reduce_transforms(transform_types, transforms_number, &target, &inverted) < 0) {
+            goto fail;
+        }
+        if (target.transposed) {
+            fprintf(stderr, "The transposed orientations can't be streamed, they need the whole image.\n");
+            goto fail;
+        }
+        output_file = strcmp(output_file_name, "-") == 0 ? stdout : fopen(output_file_name, "wb");
+        if (!output_file) {
+            fprintf(stderr, "Couldn't open the output file \"%s\".\n", output_file_name);
+            goto fail;
+        }
+        if (write_header(output_file, output_file_name, file_type, in_width, in_height, max_value) < 0) {
+            goto fail;
+        }
+        if (transform_stream(input_file, input_file_name, output_file, output_file_name,
+                             channels, in_width, in_height, target, inverted) < 0) {
+            goto fail;
+        }
+        goto end;
+    }
+
+    data_size = (size_t) channels * in_width * in_height * sizeof(uint8_t);
 
     input_data = (uint8_t *) malloc(data_size);
     if (!input_data) {
-        fprintf(stderr, "Couldn't allocate memory for the input file \"%s\"data.\n", argc[1]);
+        fprintf(stderr, "Couldn't allocate memory for the input file \"%s\"data.\n", input_file_name);
         goto fail;
     }
 
-    output_data = (uint8_t *) malloc(data_size);
-    if (!output_data) {
-        fprintf(stderr, "Couldn't allocate memory for the output file \"%s\" data.\n", argc[2]);
-        goto fail;
+    if (!in_place) {
+        output_data = (uint8_t *) malloc(data_size);
+        if (!output_data) {
+            fprintf(stderr, "Couldn't allocate memory for the output file \"%s\" data.\n", output_file_name);
+            goto fail;
+        }
     }
 
-    if (read_data(input_file, argc[1], input_data, data_size) < 0) {
+    if (read_data(input_file, input_file_name, input_data, data_size) < 0) {
         goto fail;
     }
 
-    transform_type = atoi(argc[3]);
-    if (transform(channels, transform_type, input_data, in_width, in_height,
-                  output_data, &out_width, &out_height) < 0) {
+    if (transform(channels, transform_types, transforms_number, input_data, in_width, in_height,
+                  in_place ? input_data : output_data, &result_data, &out_width, &out_height, threads_number) < 0) {
         goto fail;
     }
 
-    output_file = fopen(argc[2], "wb");
+    output_file = strcmp(output_file_name, "-") == 0 ? stdout : fopen(output_file_name, "wb");
     if (!output_file) {
-        fprintf(stderr, "Couldn't open the output file \"%s\".\n", argc[2]);
+        fprintf(stderr, "Couldn't open the output file \"%s\".\n", output_file_name);
         goto fail;
     }
 
-    if (write_header(output_file, argc[2], file_type, out_width, out_height, max_value) < 0) {
+    if (write_header(output_file, output_file_name, file_type, out_width, out_height, max_value) < 0) {
         goto fail;
     }
-    if (write_data(output_file, argc[2], output_data, data_size) < 0) {
+    if (write_data(output_file, output_file_name, result_data, data_size) < 0) {
         goto fail;
     }
 
@@ -228,21 +851,32 @@ int main(int argv, char **argc) {
     ret = 1;
 
     end:
+    if (print_memory && ret == 0) {
+        struct rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) == 0) {
+            fprintf(stderr, "Peak resident memory: %.1f MB.\n", usage.ru_maxrss / 1024.0);
+        }
+    }
     free(input_data);
     free(output_data);
     if (input_file) {
         if (fclose(input_file) != 0) {
-            fprintf(stderr, "Couldn't close the input file \"%s\".\n", argc[1]);
+            fprintf(stderr, "Couldn't close the input file \"%s\".\n", input_file_name);
             ret = 1;
         }
     }
-    if (output_file) {
+    if (output_file == stdout) {
+        if (fflush(output_file) != 0) {
+            fprintf(stderr, "Couldn't write the output data to the standard output.\n");
+            ret = 1;
+        }
+    } else if (output_file) {
         if (fclose(output_file) != 0) {
-            fprintf(stderr, "Couldn't close the output file \"%s\".\n", argc[2]);
+            fprintf(stderr, "Couldn't close the output file \"%s\".\n", output_file_name);
             ret = 1;
         }
-        if ((ret != 0) && !remove(argc[2])) {
-            fprintf(stderr, "Couldn't remove the output file \"%s\" with partially written data.\n", argc[2]);
+        if ((ret != 0) && remove(output_file_name) != 0) {
+            fprintf(stderr, "Couldn't remove the output file \"%s\" with partially written data.\n", output_file_name);
         }
     }
     return ret;
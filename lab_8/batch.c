@@ -0,0 +1,473 @@
+/*
+ * Batch decoder: decodes many JPEG files in one process. The files come from the arguments, the directories
+ * in the arguments and the list file. Every thread owns a decoder context for the whole batch, so
+ * the tables and the large buffers of the context are reused from one image to the next.
+ *
+ * The images are scheduled by work stealing. Every thread starts with its own contiguous share of the list
+ * and takes images from the head of it. When the share is empty, it steals from the tail of the other shares,
+ * so a thread which gets the large images doesn't keep the rest waiting at the end.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "common.h"
+#include "thread_pool.h"
+#include "input_file.h"
+#include "jpeg_decoder.h"
+#include "output_file.h"
+
+#define MAX_LIST_LINE 4096
+
+typedef struct file_list {
+    char **names;
+    uint32_t number;
+    uint32_t capacity;
+} file_list;
+
+/*
+ * Images of one thread, the owner takes them from the head and the other threads steal from the tail.
+ */
+typedef struct batch_queue {
+    pthread_mutex_t mutex;
+    uint32_t head;
+    uint32_t tail;
+} batch_queue;
+
+typedef struct batch_context {
+    const file_list *files;
+    const char *output_directory; /* NULL only decodes the images */
+    uint8_t scale_denominator;
+    int grayscale;
+    int verbose;
+    int threads_number;
+    batch_queue *queues; /* of every thread */
+    double *latencies; /* of every image in seconds, from opening the file to writing the last row, -1 if failed */
+    uint64_t input_bytes; /* of the decoded images */
+    uint32_t failed_images;
+    uint32_t stolen_images;
+} batch_context;
+
+typedef struct batch_worker {
+    batch_context *context;
+    int index;
+    pthread_t thread;
+} batch_worker;
+
+double get_time() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+int add_file(file_list *list, const char *name) {
+    if (list->number == list->capacity) {
+        uint32_t new_capacity = list->capacity ? list->capacity * 2 : 64;
+        char **new_names = (char **) realloc(list->names, new_capacity * sizeof(char *));
+        if (!new_names) {
+            PROCESS_ERROR("Couldn't allocate memory for the file list.\n");
+        }
+        list->names = new_names;
+        list->capacity = new_capacity;
+    }
+    list->names[list->number] = (char *) malloc(strlen(name) + 1);
+    if (!list->names[list->number]) {
+        PROCESS_ERROR("Couldn't allocate memory for the file list.\n");
+    }
+    strcpy(list->names[list->number], name);
+    ++list->number;
+    return 0;
+
+    fail:
+    return -1;
+}
+
+void destroy_file_list(file_list *list) {
+    uint32_t i;
+    for (i = 0; i < list->number; ++i) {
+        free(list->names[i]);
+    }
+    free(list->names);
+}
+
+int compare_names(const void *a, const void *b) {
+    return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+/*
+ * Checks the SOI marker at the start of the file, so the JPEG files are found whatever their extension is.
+ */
+int is_JPEG_file(const char *file_name) {
+    FILE *file = fopen(file_name, "rb");
+    uint8_t signature[2];
+    int ret;
+
+    if (!file) {
+        return 0;
+    }
+    ret = fread(signature, 1, sizeof(signature), file) == sizeof(signature) &&
+          signature[0] == 0xFF && signature[1] == 0xD8;
+    fclose(file);
+    return ret;
+}
+
+/*
+ * Adds the JPEG files of the directory in the order of their names. The other files and the subdirectories
+ * are skipped, while the files given by name are all decoded.
+ */
+int add_directory(file_list *list, const char *directory_name) {
+    DIR *directory = opendir(directory_name);
+    struct dirent *entry;
+    uint32_t first = list->number;
+    char *path = NULL;
+
+    if (!directory) {
+        PROCESS_ERROR("Couldn't open the directory \"%s\".\n", directory_name);
+    }
+    while ((entry = readdir(directory)) != NULL) {
+        struct stat file_stat;
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        path = (char *) malloc(strlen(directory_name) + strlen(entry->d_name) + 2);
+        if (!path) {
+            PROCESS_ERROR("Couldn't allocate memory for the file list.\n");
+        }
+        sprintf(path, "%s/%s", directory_name, entry->d_name);
+        if (stat(path, &file_stat) == 0 && S_ISREG(file_stat.st_mode) && is_JPEG_file(path) &&
+            add_file(list, path) < 0) {
+            goto fail;
+        }
+        free(path);
+        path = NULL;
+    }
+    closedir(directory);
+    qsort(list->names + first, list->number - first, sizeof(char *), compare_names);
+    return 0;
+
+    fail:
+    free(path);
+    if (directory) {
+        closedir(directory);
+    }
+    return -1;
+}
+
+/*
+ * Adds the files of the list, one name per line, "-" reads the list from stdin.
+ */
+int add_list_file(file_list *list, const char *list_file_name) {
+    FILE *file = strcmp(list_file_name, "-") == 0 ? stdin : fopen(list_file_name, "r");
+    char line[MAX_LIST_LINE];
+
+    if (!file) {
+        PROCESS_ERROR("Couldn't open the list file \"%s\".\n", list_file_name);
+    }
+    while (fgets(line, sizeof(line), file)) {
+        size_t length = strcspn(line, "\r\n");
+        line[length] = '\0';
+        if (length != 0 && add_file(list, line) < 0) {
+            goto fail;
+        }
+    }
+    if (file != stdin) {
+        fclose(file);
+    }
+    return 0;
+
+    fail:
+    if (file && file != stdin) {
+        fclose(file);
+    }
+    return -1;
+}
+
+/*
+ * Takes the next image of the thread: from its own queue, or stolen from the others.
+ * Returns 0 when all the queues are empty.
+ */
+int take_image(batch_context *context, int index, uint32_t *image) {
+    int i;
+
+    for (i = 0; i < context->threads_number; ++i) {
+        batch_queue *queue = &context->queues[(index + i) % context->threads_number];
+        int taken = 0;
+
+        pthread_mutex_lock(&queue->mutex);
+        if (queue->head < queue->tail) {
+            *image = i == 0 ? queue->head++ : --queue->tail;
+            taken = 1;
+        }
+        pthread_mutex_unlock(&queue->mutex);
+        if (taken) {
+            if (i != 0) {
+                __sync_fetch_and_add(&context->stolen_images, 1);
+            }
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Output file of the image: its name without the extension in the output directory.
+ */
+char *get_output_file_name(const char *output_directory, const char *input_file_name) {
+    const char *base_name = strrchr(input_file_name, '/');
+    const char *extension;
+    size_t base_length;
+    char *output_file_name;
+
+    base_name = base_name ? base_name + 1 : input_file_name;
+    extension = strrchr(base_name, '.');
+    base_length = extension && extension != base_name ? (size_t) (extension - base_name) : strlen(base_name);
+    output_file_name = (char *) malloc(strlen(output_directory) + base_length + sizeof("/.pnm"));
+    if (output_file_name) {
+        sprintf(output_file_name, "%s/%.*s.pnm", output_directory, (int) base_length, base_name);
+    }
+    return output_file_name;
+}
+
+int decode_image(batch_context *context, jpeg_decoder *decoder, const char *file_name) {
+    input_file input;
+    output_file output;
+    int ret = 0;
+
+    output.file = NULL;
+    output.file_name = NULL;
+    if (open_input_file(&input, file_name) < 0) {
+        return -1;
+    }
+
+    decoder->row_callback = NULL;
+    if (context->output_directory) {
+        output.file_name = get_output_file_name(context->output_directory, file_name);
+        if (!output.file_name) {
+            PROCESS_ERROR("Couldn't allocate memory for the output file name.\n");
+        }
+        output.file = fopen(output.file_name, "wb");
+        if (!output.file) {
+            PROCESS_ERROR("Couldn't open the output file \"%s\".\n", output.file_name);
+        }
+        output.decoder = decoder;
+        decoder->row_callback = write_output_rows;
+        decoder->row_callback_arg = &output;
+    }
+
+    if (decode_JPEG(decoder, input.data, input.size) < 0) {
+        PROCESS_ERROR("Couldn't decode the file \"%s\".\n", file_name);
+    }
+    __sync_fetch_and_add(&context->input_bytes, input.size);
+
+    goto end;
+
+    fail:
+    ret = -1;
+
+    end:
+    if (close_output_file(&output, ret < 0) < 0) {
+        ret = -1;
+    }
+    free(output.file_name);
+    close_input_file(&input);
+    return ret;
+}
+
+void *batch_worker_thread(void *arg) {
+    batch_worker *worker = (batch_worker *) arg;
+    batch_context *context = worker->context;
+    jpeg_decoder decoder;
+    uint32_t image;
+
+    init_jpeg_decoder(&decoder);
+    decoder.scale_denominator = context->scale_denominator;
+    decoder.grayscale = context->grayscale;
+    while (take_image(context, worker->index, &image)) {
+        double start_time = get_time();
+        if (decode_image(context, &decoder, context->files->names[image]) < 0) {
+            __sync_fetch_and_add(&context->failed_images, 1);
+            context->latencies[image] = -1;
+        } else {
+            context->latencies[image] = get_time() - start_time;
+        }
+    }
+    destroy_jpeg_decoder(&decoder);
+    return NULL;
+}
+
+int compare_latencies(const void *a, const void *b) {
+    double difference = *(const double *) a - *(const double *) b;
+    return (difference > 0) - (difference < 0);
+}
+
+/*
+ * Nearest-rank percentile of the sorted values.
+ */
+double get_percentile(const double *sorted_values, uint32_t number, int percent) {
+    uint32_t rank = (uint32_t) ((uint64_t) number * percent / 100);
+    if ((uint64_t) rank * 100 < (uint64_t) number * percent) {
+        ++rank;
+    }
+    return sorted_values[rank > 0 ? rank - 1 : 0];
+}
+
+/*
+ * Decodes all the files and returns the elapsed time in seconds.
+ */
+double run_batch(batch_context *context) {
+    batch_worker *workers = (batch_worker *) malloc(context->threads_number * sizeof(batch_worker));
+    uint32_t files_number = context->files->number;
+    double start_time;
+    int started;
+    int i;
+
+    for (i = 0; i < context->threads_number; ++i) {
+        batch_queue *queue = &context->queues[i];
+        pthread_mutex_init(&queue->mutex, NULL);
+        queue->head = (uint32_t) ((uint64_t) files_number * i / context->threads_number);
+        queue->tail = (uint32_t) ((uint64_t) files_number * (i + 1) / context->threads_number);
+        workers[i].context = context;
+        workers[i].index = i;
+    }
+
+    start_time = get_time();
+    for (started = 0; started < context->threads_number; ++started) {
+        if (pthread_create(&workers[started].thread, NULL, batch_worker_thread, &workers[started]) != 0) {
+            fprintf(stderr, "Couldn't start the decoding thread, running with %d threads.\n", started);
+            break;
+        }
+    }
+    if (started == 0) { /* The queues of the threads which didn't start are stolen */
+        batch_worker_thread(&workers[0]);
+    }
+    for (i = 0; i < started; ++i) {
+        pthread_join(workers[i].thread, NULL);
+    }
+
+    for (i = 0; i < context->threads_number; ++i) {
+        pthread_mutex_destroy(&context->queues[i].mutex);
+    }
+    free(workers);
+    return get_time() - start_time;
+}
+
+int parse_args(int argc, char **argv, batch_context *context, file_list *files) {
+    int option;
+    int i;
+
+    context->threads_number = get_cpu_number();
+    while ((option = getopt(argc, argv, "t:s:l:o:gv")) != -1) {
+        if (option == 't') {
+            context->threads_number = atoi(optarg);
+            if (context->threads_number <= 0) {
+                PROCESS_ERROR("Incorrect number of threads \"%s\". Must be more than 0.\n", optarg);
+            }
+        } else if (option == 's') {
+            int denominator = atoi(optarg);
+            if (denominator != 1 && denominator != 2 && denominator != 4 && denominator != 8) {
+                PROCESS_ERROR("Incorrect scale denominator \"%s\". Must be 1, 2, 4 or 8.\n", optarg);
+            }
+            context->scale_denominator = denominator;
+        } else if (option == 'l') {
+            if (add_list_file(files, optarg) < 0) {
+                return -1;
+            }
+        } else if (option == 'o') {
+            context->output_directory = optarg;
+        } else if (option == 'g') {
+            context->grayscale = 1;
+        } else if (option == 'v') {
+            context->verbose = 1;
+        } else {
+            goto fail;
+        }
+    }
+    for (i = optind; i < argc; ++i) {
+        struct stat file_stat;
+        if (stat(argv[i], &file_stat) == 0 && S_ISDIR(file_stat.st_mode) ? add_directory(files, argv[i]) < 0
+                                                                         : add_file(files, argv[i]) < 0) {
+            return -1;
+        }
+    }
+    if (files->number == 0) {
+        PROCESS_ERROR("No input files.\n");
+    }
+
+    goto end;
+
+    fail:
+    fprintf(stderr, "Usage: %s [-t threads_number] [-s 1|2|4|8] [-g] [-v] [-o output_directory] [-l list_file|-] "
+                    "[input_file|input_directory]...\n", argv[0]);
+    return -1;
+
+    end:
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    batch_context context;
+    file_list files;
+    double *sorted_latencies = NULL;
+    double time;
+    uint32_t decoded_images = 0;
+    uint32_t i;
+
+    int ret = 0;
+
+    memset(&context, 0, sizeof(batch_context));
+    memset(&files, 0, sizeof(file_list));
+    context.scale_denominator = 1;
+    if (parse_args(argc, argv, &context, &files) < 0) {
+        goto fail;
+    }
+
+    context.files = &files;
+    context.threads_number = (int) MIN((uint32_t) context.threads_number, files.number);
+    context.queues = (batch_queue *) malloc(context.threads_number * sizeof(batch_queue));
+    context.latencies = (double *) calloc(files.number, sizeof(double));
+    sorted_latencies = (double *) malloc(files.number * sizeof(double));
+    if (!context.queues || !context.latencies || !sorted_latencies) {
+        PROCESS_ERROR("Couldn't allocate memory for %u images.\n", files.number);
+    }
+
+    time = run_batch(&context);
+
+    /* The throughput and the latencies are of the decoded images only, the failures are counted apart */
+    for (i = 0; i < files.number; ++i) {
+        if (context.latencies[i] >= 0) {
+            sorted_latencies[decoded_images++] = context.latencies[i];
+        }
+    }
+    qsort(sorted_latencies, decoded_images, sizeof(double), compare_latencies);
+    printf("%u images decoded, %u failed, %d threads: %.3f s, %.1f images/s, %.1f MB/s of input.\n",
+           decoded_images, context.failed_images, context.threads_number, time, decoded_images / time,
+           context.input_bytes / time / (1 << 20));
+    if (decoded_images != 0) {
+        printf("Latency per image, ms: p50 %.3f, p99 %.3f, max %.3f.\n",
+               get_percentile(sorted_latencies, decoded_images, 50) * 1e3,
+               get_percentile(sorted_latencies, decoded_images, 99) * 1e3, sorted_latencies[decoded_images - 1] * 1e3);
+    }
+    if (context.verbose) {
+        printf("%u images were stolen from the queues of the other threads.\n", context.stolen_images);
+    }
+    if (context.failed_images != 0) {
+        ret = 1;
+    }
+
+    goto end;
+
+    fail:
+    ret = 1;
+
+    end:
+    free(sorted_latencies);
+    free(context.latencies);
+    free(context.queues);
+    destroy_file_list(&files);
+    return ret;
+}
@@ -0,0 +1,264 @@
+/*
+ * Batch decoding benchmark: the same image is decoded many times by several threads at once,
+ * every thread owns its jpeg_decoder context. Prints the throughput for 1, 2, 4, ... threads.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "common.h"
+#include "thread_pool.h"
+#include "input_file.h"
+#include "jpeg_decoder.h"
+
+#define DEFAULT_IMAGES_NUMBER 64
+
+#ifdef LAB8_COUNT_ALLOCATIONS
+/*
+ * The benchmark is linked with --wrap for malloc, calloc and realloc, so every heap allocation is counted.
+ */
+static unsigned long allocations_number = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t number, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size) {
+    __sync_fetch_and_add(&allocations_number, 1);
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t number, size_t size) {
+    __sync_fetch_and_add(&allocations_number, 1);
+    return __real_calloc(number, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    __sync_fetch_and_add(&allocations_number, 1);
+    return __real_realloc(ptr, size);
+}
+#endif
+
+typedef struct benchmark_context {
+    const uint8_t *input_data;
+    size_t input_data_size;
+    uint8_t scale_denominator;
+    int grayscale;
+    uint32_t reference_checksum;
+    int images_number;
+    int next_image;
+    int failed_images;
+    pthread_mutex_t mutex;
+} benchmark_context;
+
+double get_time() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+uint32_t get_checksum(const jpeg_decoder *decoder) {
+    size_t size = (size_t) decoder->output_width * decoder->output_height * decoder->output_components_number *
+                  decoder->sample_size;
+    uint32_t checksum = 0;
+    size_t i;
+    for (i = 0; i < size; ++i) {
+        checksum = checksum * 31 + decoder->output_data[i];
+    }
+    return checksum;
+}
+
+void *benchmark_worker(void *arg) {
+    benchmark_context *context = (benchmark_context *) arg;
+    jpeg_decoder decoder;
+
+    init_jpeg_decoder(&decoder);
+    decoder.scale_denominator = context->scale_denominator;
+    decoder.grayscale = context->grayscale;
+    while (1) {
+        int failed;
+
+        pthread_mutex_lock(&context->mutex);
+        if (context->next_image == context->images_number) {
+            pthread_mutex_unlock(&context->mutex);
+            break;
+        }
+        ++context->next_image;
+        pthread_mutex_unlock(&context->mutex);
+
+        /* Every decode must give the same pixels as the single-threaded reference one */
+        failed = decode_JPEG(&decoder, context->input_data, context->input_data_size) < 0 ||
+                 get_checksum(&decoder) != context->reference_checksum;
+        if (failed) {
+            pthread_mutex_lock(&context->mutex);
+            ++context->failed_images;
+            pthread_mutex_unlock(&context->mutex);
+        }
+    }
+    destroy_jpeg_decoder(&decoder);
+    return NULL;
+}
+
+/*
+ * Decodes all the images with threads_number threads and returns the elapsed time in seconds.
+ */
+double run_benchmark(benchmark_context *context, int threads_number) {
+    pthread_t *threads = (pthread_t *) malloc(threads_number * sizeof(pthread_t));
+    double start_time;
+    int started;
+    int i;
+
+    context->next_image = 0;
+    context->failed_images = 0;
+
+    start_time = get_time();
+    for (started = 0; started < threads_number; ++started) {
+        if (pthread_create(&threads[started], NULL, benchmark_worker, context) != 0) {
+            fprintf(stderr, "Couldn't start the benchmark thread, running with %d threads.\n", started);
+            break;
+        }
+    }
+    if (started == 0) {
+        benchmark_worker(context);
+    }
+    for (i = 0; i < started; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+
+    free(threads);
+    return get_time() - start_time;
+}
+
+int parse_args(int argc, char **argv, int *images_number, int *max_threads_number, uint8_t *scale_denominator,
+               int *grayscale, char **input_file_name) {
+    int option;
+
+    *images_number = DEFAULT_IMAGES_NUMBER;
+    *max_threads_number = get_cpu_number();
+    *scale_denominator = 1;
+    *grayscale = 0;
+    while ((option = getopt(argc, argv, "n:t:s:g")) != -1) {
+        if (option == 'n') {
+            *images_number = atoi(optarg);
+            if (*images_number <= 0) {
+                PROCESS_ERROR("Incorrect number of images \"%s\". Must be more than 0.\n", optarg);
+            }
+        } else if (option == 't') {
+            *max_threads_number = atoi(optarg);
+            if (*max_threads_number <= 0) {
+                PROCESS_ERROR("Incorrect number of threads \"%s\". Must be more than 0.\n", optarg);
+            }
+        } else if (option == 's') {
+            int denominator = atoi(optarg);
+            if (denominator != 1 && denominator != 2 && denominator != 4 && denominator != 8) {
+                PROCESS_ERROR("Incorrect scale denominator \"%s\". Must be 1, 2, 4 or 8.\n", optarg);
+            }
+            *scale_denominator = denominator;
+        } else if (option == 'g') {
+            *grayscale = 1;
+        } else {
+            goto fail;
+        }
+    }
+    if (argc - optind != 1) {
+        PROCESS_ERROR("Incorrect number of arguments.\n");
+    }
+    *input_file_name = argv[optind];
+
+    goto end;
+
+    fail:
+    fprintf(stderr, "Usage: %s [-n images_number] [-t max_threads] [-s 1|2|4|8] [-g] <input_file_name|->\n", argv[0]);
+    return -1;
+
+    end:
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    char *input_file_name;
+    int images_number;
+    int max_threads_number;
+    uint8_t scale_denominator;
+    int grayscale;
+    input_file input;
+    benchmark_context context;
+    jpeg_decoder decoder;
+    double single_thread_time;
+    int threads_number;
+
+    int ret = 0;
+
+    input.data = NULL;
+    input.mapped = 0;
+    init_jpeg_decoder(&decoder);
+    pthread_mutex_init(&context.mutex, NULL);
+    if (parse_args(argc, argv, &images_number, &max_threads_number, &scale_denominator, &grayscale,
+                   &input_file_name) < 0) {
+        goto fail;
+    }
+
+    if (open_input_file(&input, input_file_name) < 0) {
+        goto fail;
+    }
+
+    decoder.scale_denominator = scale_denominator;
+    decoder.grayscale = grayscale;
+#ifdef LAB8_COUNT_ALLOCATIONS
+    allocations_number = 0;
+#endif
+    if (decode_JPEG(&decoder, input.data, input.size) < 0) {
+        PROCESS_ERROR("Couldn't decode the input file \"%s\".\n", input_file_name);
+    }
+
+    context.input_data = input.data;
+    context.input_data_size = input.size;
+    context.scale_denominator = scale_denominator;
+    context.grayscale = grayscale;
+    context.reference_checksum = get_checksum(&decoder);
+    context.images_number = images_number;
+
+    printf("%s: %dx%d, %d components, %d images per run.\n", input_file_name, decoder.output_width,
+           decoder.output_height, decoder.output_components_number, images_number);
+#ifdef LAB8_COUNT_ALLOCATIONS
+    printf("Heap allocations per image: %lu.\n", allocations_number);
+#endif
+    printf("threads   time, s   images/s   speedup   efficiency\n");
+
+    single_thread_time = 0;
+    threads_number = 1;
+    while (1) {
+        double time = run_benchmark(&context, threads_number);
+        double speedup;
+
+        if (context.failed_images != 0) {
+            PROCESS_ERROR("%d of %d images were decoded incorrectly with %d threads.\n",
+                          context.failed_images, images_number, threads_number);
+        }
+        if (threads_number == 1) {
+            single_thread_time = time;
+        }
+        speedup = single_thread_time / time;
+        printf("%7d %9.3f %10.1f %9.2f %11.0f%%\n", threads_number, time, images_number / time, speedup,
+               speedup / threads_number * 100.);
+
+        if (threads_number == max_threads_number) {
+            break;
+        }
+        threads_number = MIN(threads_number * 2, max_threads_number);
+    }
+
+    goto end;
+
+    fail:
+    ret = 1;
+
+    end:
+    destroy_jpeg_decoder(&decoder);
+    close_input_file(&input);
+    pthread_mutex_destroy(&context.mutex);
+
+    return ret;
+}
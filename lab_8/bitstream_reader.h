@@ -20,7 +20,9 @@ uint32_t find_next_marker_position(bitstream_reader *bit_ctx) {
     uint32_t index;
     assert((bit_ctx->index & 7) == 0);
     for (index = bit_ctx->index; index < bit_ctx->bits_size; index += 8) {
-        if (bit_ctx->buffer[index >> 3] == 0xFF && bit_ctx->buffer[(index >> 3) + 1] != 0x00) {
+        /* The byte after the last one is never read: the buffer may be the mapping of the file */
+        if (bit_ctx->buffer[index >> 3] == 0xFF &&
+            (index + 8 >= bit_ctx->bits_size || bit_ctx->buffer[(index >> 3) + 1] != 0x00)) {
             break;
         }
     }
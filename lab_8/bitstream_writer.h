@@ -0,0 +1,107 @@
+/*
+ * Growing output buffer for the JPEG encoder: raw bytes of the segments and entropy-coded bits with 0xFF stuffing.
+ */
+
+#ifndef LAB8_BITSTREAM_WRITER_H
+#define LAB8_BITSTREAM_WRITER_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#define WRITER_INITIAL_CAPACITY 4096
+
+typedef struct bitstream_writer {
+    uint8_t *buffer;
+    size_t size;
+    size_t capacity;
+    uint32_t bits; /* bits not written yet, aligned to the right */
+    int bits_number;
+    int failed; /* an allocation failed, the rest of the output is dropped */
+} bitstream_writer;
+
+void init_bitstream_writer(bitstream_writer *writer) {
+    writer->buffer = NULL;
+    writer->size = 0;
+    writer->capacity = 0;
+    writer->bits = 0;
+    writer->bits_number = 0;
+    writer->failed = 0;
+}
+
+void destroy_bitstream_writer(bitstream_writer *writer) {
+    free(writer->buffer);
+    init_bitstream_writer(writer);
+}
+
+/*
+ * Makes room for size more bytes.
+ */
+int reserve_bytes(bitstream_writer *writer, size_t size) {
+    uint8_t *new_buffer;
+    size_t new_capacity;
+
+    if (writer->size + size <= writer->capacity) {
+        return !writer->failed;
+    }
+    new_capacity = writer->capacity ? writer->capacity : WRITER_INITIAL_CAPACITY;
+    while (new_capacity < writer->size + size) {
+        new_capacity *= 2;
+    }
+    new_buffer = (uint8_t *) realloc(writer->buffer, new_capacity);
+    if (!new_buffer) {
+        writer->failed = 1;
+        return 0;
+    }
+    writer->buffer = new_buffer;
+    writer->capacity = new_capacity;
+    return !writer->failed;
+}
+
+void put_byte(bitstream_writer *writer, uint8_t value) {
+    if (reserve_bytes(writer, 1)) {
+        writer->buffer[writer->size++] = value;
+    }
+}
+
+void put_16bit(bitstream_writer *writer, uint16_t value) {
+    put_byte(writer, (uint8_t) (value >> 8));
+    put_byte(writer, (uint8_t) (value & 0xFF));
+}
+
+void put_bytes(bitstream_writer *writer, const uint8_t *data, size_t size) {
+    if (reserve_bytes(writer, size)) {
+        memcpy(writer->buffer + writer->size, data, size);
+        writer->size += size;
+    }
+}
+
+/*
+ * Appends length <= 16 low bits of the value to the entropy-coded data, 0xFF is followed by the stuffed 0x00.
+ * The caller reserves the space for the bytes with reserve_bytes().
+ */
+void write_bits(bitstream_writer *writer, uint32_t value, int length) {
+    writer->bits = (writer->bits << length) | (value & ((1u << length) - 1));
+    writer->bits_number += length;
+    while (writer->bits_number >= 8) {
+        uint8_t byte = (uint8_t) (writer->bits >> (writer->bits_number - 8));
+        writer->buffer[writer->size++] = byte;
+        if (byte == 0xFF) {
+            writer->buffer[writer->size++] = 0x00;
+        }
+        writer->bits_number -= 8;
+    }
+}
+
+/*
+ * Pads the last byte of the entropy-coded data with ones.
+ */
+void flush_bits(bitstream_writer *writer) {
+    if (writer->bits_number > 0 && reserve_bytes(writer, 2)) {
+        write_bits(writer, 0x7F, 8 - writer->bits_number);
+    }
+    writer->bits = 0;
+    writer->bits_number = 0;
+}
+
+#endif
@@ -0,0 +1,115 @@
+/*
+ * Fixed-point YCbCr -> RGB conversion of a row of pixels into the interleaved RGB output.
+ */
+
+#ifndef LAB8_COLOR_CONVERT_H
+#define LAB8_COLOR_CONVERT_H
+
+#include <stdint.h>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include "common.h"
+
+/*
+ * Conversion coefficients multiplied by 2^13. Chroma differences are multiplied by 4 before the
+ * rounding high multiplication, so (C - 128) * 4 * K / 2^15 = (C - 128) * K / 2^13 fits into 16 bits.
+ */
+#define CR_TO_R 11485 /* 1.402 */
+#define CB_TO_G 2819  /* 0.34414 */
+#define CR_TO_G 5850  /* 0.71414 */
+#define CB_TO_B 14516 /* 1.772 */
+
+/*
+ * Scalar equivalent of the rounding high multiplication (pmulhrsw), so both paths give the same pixels.
+ */
+int16_t multiply_high_round(int16_t a, int16_t b) {
+    return (int16_t) ((a * b + (1 << 14)) >> 15);
+}
+
+#ifdef __AVX2__
+/*
+ * Converts 16 pixels.
+ */
+void YCbCr_to_RGB_16_AVX2(const uint8_t *Y_values, const uint8_t *Cb_values, const uint8_t *Cr_values,
+                          uint8_t *RGB_values) {
+    const __m256i center = _mm256_set1_epi16(128);
+    __m256i Y = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) Y_values));
+    __m256i Cb = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) Cb_values));
+    __m256i Cr = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) Cr_values));
+    __m256i R, G, B, RG, BB;
+    __m128i R8, G8, B8;
+
+    Cb = _mm256_slli_epi16(_mm256_sub_epi16(Cb, center), 2);
+    Cr = _mm256_slli_epi16(_mm256_sub_epi16(Cr, center), 2);
+
+    R = _mm256_add_epi16(Y, _mm256_mulhrs_epi16(Cr, _mm256_set1_epi16(CR_TO_R)));
+    G = _mm256_sub_epi16(_mm256_sub_epi16(Y, _mm256_mulhrs_epi16(Cb, _mm256_set1_epi16(CB_TO_G))),
+                         _mm256_mulhrs_epi16(Cr, _mm256_set1_epi16(CR_TO_G)));
+    B = _mm256_add_epi16(Y, _mm256_mulhrs_epi16(Cb, _mm256_set1_epi16(CB_TO_B)));
+
+    /* Saturating pack works inside 128-bit lanes, so the quad words are reordered afterwards */
+    RG = _mm256_permute4x64_epi64(_mm256_packus_epi16(R, G), _MM_SHUFFLE(3, 1, 2, 0));
+    BB = _mm256_permute4x64_epi64(_mm256_packus_epi16(B, B), _MM_SHUFFLE(3, 1, 2, 0));
+    R8 = _mm256_castsi256_si128(RG);
+    G8 = _mm256_extracti128_si256(RG, 1);
+    B8 = _mm256_castsi256_si128(BB);
+
+    /* Interleave the planes into 48 bytes of RGB triplets, -1 in the shuffle mask gives zero */
+    _mm_storeu_si128((__m128i *) RGB_values, _mm_or_si128(_mm_or_si128(
+            _mm_shuffle_epi8(R8, _mm_setr_epi8(0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1, 5)),
+            _mm_shuffle_epi8(G8, _mm_setr_epi8(-1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1))),
+            _mm_shuffle_epi8(B8, _mm_setr_epi8(-1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1))));
+    _mm_storeu_si128((__m128i *) (RGB_values + 16), _mm_or_si128(_mm_or_si128(
+            _mm_shuffle_epi8(R8, _mm_setr_epi8(-1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10, -1)),
+            _mm_shuffle_epi8(G8, _mm_setr_epi8(5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10))),
+            _mm_shuffle_epi8(B8, _mm_setr_epi8(-1, 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1))));
+    _mm_storeu_si128((__m128i *) (RGB_values + 32), _mm_or_si128(_mm_or_si128(
+            _mm_shuffle_epi8(R8, _mm_setr_epi8(-1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1, -1)),
+            _mm_shuffle_epi8(G8, _mm_setr_epi8(-1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1))),
+            _mm_shuffle_epi8(B8, _mm_setr_epi8(10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15))));
+}
+#endif
+
+void YCbCr_to_RGB_row(const uint8_t *Y_values, const uint8_t *Cb_values, const uint8_t *Cr_values,
+                      uint8_t *RGB_values, int width) {
+    int i = 0;
+#ifdef __AVX2__
+    for (; i + 16 <= width; i += 16) {
+        YCbCr_to_RGB_16_AVX2(Y_values + i, Cb_values + i, Cr_values + i, RGB_values + 3 * i);
+    }
+#endif
+    for (; i < width; ++i) {
+        int16_t Cb = (int16_t) ((Cb_values[i] - 128) * 4);
+        int16_t Cr = (int16_t) ((Cr_values[i] - 128) * 4);
+        int R = Y_values[i] + multiply_high_round(Cr, CR_TO_R);
+        int G = Y_values[i] - multiply_high_round(Cb, CB_TO_G) - multiply_high_round(Cr, CR_TO_G);
+        int B = Y_values[i] + multiply_high_round(Cb, CB_TO_B);
+        RGB_values[3 * i] = (uint8_t) CLIP(0, R, 255);
+        RGB_values[3 * i + 1] = (uint8_t) CLIP(0, G, 255);
+        RGB_values[3 * i + 2] = (uint8_t) CLIP(0, B, 255);
+    }
+}
+
+/*
+ * Conversion of the samples of more than 8 bits in 32-bit arithmetic, max_value is 4095 for the 12-bit ones.
+ */
+void YCbCr_to_RGB_row_16(const uint16_t *Y_values, const uint16_t *Cb_values, const uint16_t *Cr_values,
+                         uint16_t *RGB_values, int width, uint16_t max_value) {
+    int32_t center = (max_value + 1) / 2;
+    int i;
+    for (i = 0; i < width; ++i) {
+        int32_t Cb = Cb_values[i] - center;
+        int32_t Cr = Cr_values[i] - center;
+        int32_t R = Y_values[i] + ((Cr * CR_TO_R + (1 << 12)) >> 13);
+        int32_t G = Y_values[i] - ((Cb * CB_TO_G + Cr * CR_TO_G + (1 << 12)) >> 13);
+        int32_t B = Y_values[i] + ((Cb * CB_TO_B + (1 << 12)) >> 13);
+        RGB_values[3 * i] = (uint16_t) CLIP(0, R, max_value);
+        RGB_values[3 * i + 1] = (uint16_t) CLIP(0, G, max_value);
+        RGB_values[3 * i + 2] = (uint16_t) CLIP(0, B, max_value);
+    }
+}
+
+#endif
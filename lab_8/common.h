@@ -13,6 +13,11 @@
 #define LOG_STDOUT(...)
 #endif
 
+/* Per-stage timers and counters of the decoder (profiler.h), 0 compiles them out */
+#ifndef PROFILING_ENABLE
+#define PROFILING_ENABLE 1
+#endif
+
 #define LOG_MATRIX_W_H(m, w, h)                          \
     {                                                \
         int u, v;                                    \
@@ -28,6 +33,12 @@
 #define MAX(a, b) (((a)>(b))?(a):(b))
 #define CLIP(min, val, max) (MIN(MAX(min, val), max))
 
+#define ALIGNED(n) __attribute__((aligned(n)))
+
+/* The bit positions of bitstream_reader are 32-bit, so the JPEG data is less than 512 MB, with a margin
+ * for the positions a few bytes past the end */
+#define MAX_INPUT_SIZE (((size_t) 1 << 29) - 64)
+
 #define PROCESS_ERROR(...) {      \
     fprintf(stderr, __VA_ARGS__); \
     goto fail;                    \
@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "common.h"
+#include "thread_pool.h"
+#include "input_file.h"
+#include "pnm.h"
+#include "jpeg_encoder.h"
+
+int parse_args(int argc, char **argv, jpeg_encoder *encoder, int *threads_number,
+               char **input_file_name, char **output_file_name) {
+    int option;
+
+    *threads_number = get_cpu_number();
+    while ((option = getopt(argc, argv, "q:t:c:ob:")) != -1) {
+        if (option == 'q') {
+            encoder->quality = atoi(optarg);
+            if (encoder->quality < 1 || encoder->quality > 100) {
+                PROCESS_ERROR("Incorrect quality \"%s\". Must be from 1 to 100.\n", optarg);
+            }
+        } else if (option == 't') {
+            *threads_number = atoi(optarg);
+            if (*threads_number <= 0) {
+                PROCESS_ERROR("Incorrect number of threads \"%s\". Must be more than 0.\n", optarg);
+            }
+        } else if (option == 'c') {
+            if (strcmp(optarg, "444") == 0) {
+                encoder->chroma_subsampling = 1;
+            } else if (strcmp(optarg, "420") == 0) {
+                encoder->chroma_subsampling = 2;
+            } else {
+                PROCESS_ERROR("Incorrect chroma subsampling \"%s\". Must be 444 or 420.\n", optarg);
+            }
+        } else if (option == 'o') {
+            encoder->optimize_Huffman = 1;
+        } else if (option == 'b') {
+            int band_MCU_rows = atoi(optarg);
+            if (band_MCU_rows <= 0) {
+                PROCESS_ERROR("Incorrect number of MCU rows in a band \"%s\". Must be more than 0.\n", optarg);
+            }
+            encoder->band_MCU_rows = band_MCU_rows;
+        } else {
+            goto fail;
+        }
+    }
+    if (argc - optind != 2) {
+        PROCESS_ERROR("Incorrect number of arguments.\n");
+    }
+    *input_file_name = argv[optind];
+    *output_file_name = argv[optind + 1];
+
+    goto end;
+
+    fail:
+    fprintf(stderr, "Usage: %s [-q quality] [-t threads_number] [-c 444|420] [-o] [-b band_MCU_rows] <input_file_name.pnm|-> <output_file_name>\n", argv[0]);
+    return -1;
+
+    end:
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    char *input_file_name;
+    char *output_file_name;
+    input_file input;
+    pnm_image image;
+    jpeg_encoder encoder;
+    FILE *output_file = NULL;
+    int threads_number;
+    thread_pool pool;
+    int pool_started = 0;
+
+    int ret = 0;
+
+    input.data = NULL;
+    input.mapped = 0;
+    init_jpeg_encoder(&encoder);
+    if (parse_args(argc, argv, &encoder, &threads_number, &input_file_name, &output_file_name) < 0) {
+        goto fail;
+    }
+
+    if (open_input_file(&input, input_file_name) < 0) {
+        goto fail;
+    }
+    if (parse_PNM(&image, input.data, input.size) < 0) {
+        goto fail;
+    }
+
+    if (init_thread_pool(&pool, threads_number) < 0) {
+        PROCESS_ERROR("Couldn't start %d encoding threads.\n", threads_number);
+    }
+    pool_started = 1;
+    encoder.pool = &pool;
+
+    if (encode_JPEG(&encoder, image.pixels, image.width, image.height, image.components_number) < 0) {
+        goto fail;
+    }
+
+    output_file = fopen(output_file_name, "wb");
+    if (!output_file) {
+        PROCESS_ERROR("Couldn't open the output file \"%s\".\n", output_file_name);
+    }
+    if (fwrite(encoder.output.buffer, sizeof(uint8_t), encoder.output.size, output_file) != encoder.output.size) {
+        PROCESS_ERROR("Couldn't write the output file \"%s\".\n", output_file_name);
+    }
+
+    goto end;
+
+    fail:
+    ret = 1;
+
+    end:
+    if (pool_started) {
+        destroy_thread_pool(&pool);
+    }
+    destroy_jpeg_encoder(&encoder);
+    close_input_file(&input);
+
+    if (output_file && fclose(output_file) != 0) {
+        fprintf(stderr, "Couldn't close the output file \"%s\".\n", output_file_name);
+        ret = 1;
+    }
+    return ret;
+}
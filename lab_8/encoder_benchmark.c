@@ -0,0 +1,172 @@
+/*
+ * Encoding benchmark: the image is encoded several times at the qualities 50, 75, 90 and 95 with the standard
+ * and the optimal Huffman tables. Prints the speed, the size and the PSNR of the result decoded back.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+
+#include "common.h"
+#include "thread_pool.h"
+#include "input_file.h"
+#include "pnm.h"
+#include "jpeg_encoder.h"
+#include "jpeg_decoder.h"
+
+#define DEFAULT_ENCODES_NUMBER 8
+
+static const int benchmark_qualities[] = {50, 75, 90, 95};
+
+double get_time() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+/*
+ * PSNR of the decoded JPEG against the source image, -1 if the JPEG couldn't be decoded.
+ */
+double get_PSNR(const pnm_image *image, const uint8_t *data, size_t size) {
+    jpeg_decoder decoder;
+    size_t samples_number = (size_t) image->width * image->height * image->components_number;
+    double squared_error = 0;
+    double PSNR = -1;
+    size_t i;
+
+    init_jpeg_decoder(&decoder);
+    if (decode_JPEG(&decoder, data, size) == 0 && decoder.output_width == image->width &&
+        decoder.output_height == image->height && decoder.components_number == image->components_number) {
+        for (i = 0; i < samples_number; ++i) {
+            double difference = (double) decoder.output_data[i] - image->pixels[i];
+            squared_error += difference * difference;
+        }
+        PSNR = squared_error == 0 ? INFINITY : 10 * log10(255. * 255. * samples_number / squared_error);
+    }
+    destroy_jpeg_decoder(&decoder);
+    return PSNR;
+}
+
+int parse_args(int argc, char **argv, int *encodes_number, int *threads_number, uint8_t *chroma_subsampling,
+               char **input_file_name) {
+    int option;
+
+    *encodes_number = DEFAULT_ENCODES_NUMBER;
+    *threads_number = get_cpu_number();
+    *chroma_subsampling = 2;
+    while ((option = getopt(argc, argv, "n:t:c:")) != -1) {
+        if (option == 'n') {
+            *encodes_number = atoi(optarg);
+            if (*encodes_number <= 0) {
+                PROCESS_ERROR("Incorrect number of encodes \"%s\". Must be more than 0.\n", optarg);
+            }
+        } else if (option == 't') {
+            *threads_number = atoi(optarg);
+            if (*threads_number <= 0) {
+                PROCESS_ERROR("Incorrect number of threads \"%s\". Must be more than 0.\n", optarg);
+            }
+        } else if (option == 'c') {
+            if (strcmp(optarg, "444") == 0) {
+                *chroma_subsampling = 1;
+            } else if (strcmp(optarg, "420") == 0) {
+                *chroma_subsampling = 2;
+            } else {
+                PROCESS_ERROR("Incorrect chroma subsampling \"%s\". Must be 444 or 420.\n", optarg);
+            }
+        } else {
+            goto fail;
+        }
+    }
+    if (argc - optind != 1) {
+        PROCESS_ERROR("Incorrect number of arguments.\n");
+    }
+    *input_file_name = argv[optind];
+
+    goto end;
+
+    fail:
+    fprintf(stderr, "Usage: %s [-n encodes_number] [-t threads_number] [-c 444|420] <input_file_name.pnm|->\n",
+            argv[0]);
+    return -1;
+
+    end:
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    char *input_file_name;
+    int encodes_number;
+    int threads_number;
+    uint8_t chroma_subsampling;
+    input_file input;
+    pnm_image image;
+    jpeg_encoder encoder;
+    thread_pool pool;
+    int pool_started = 0;
+    double megapixels;
+    int quality_index, optimize_Huffman, i;
+
+    int ret = 0;
+
+    input.data = NULL;
+    input.mapped = 0;
+    init_jpeg_encoder(&encoder);
+    if (parse_args(argc, argv, &encodes_number, &threads_number, &chroma_subsampling, &input_file_name) < 0) {
+        goto fail;
+    }
+
+    if (open_input_file(&input, input_file_name) < 0) {
+        goto fail;
+    }
+    if (parse_PNM(&image, input.data, input.size) < 0) {
+        goto fail;
+    }
+
+    if (init_thread_pool(&pool, threads_number) < 0) {
+        PROCESS_ERROR("Couldn't start %d encoding threads.\n", threads_number);
+    }
+    pool_started = 1;
+    encoder.pool = &pool;
+    encoder.chroma_subsampling = chroma_subsampling;
+
+    megapixels = (double) image.width * image.height * 1e-6;
+    printf("%s: %dx%d, %d components, %d threads, %d encodes per run.\n", input_file_name, image.width,
+           image.height, image.components_number, threads_number, encodes_number);
+    printf("quality   tables     time, s     MP/s      size, B      bpp    PSNR, dB\n");
+
+    for (quality_index = 0; quality_index < (int) (sizeof(benchmark_qualities) / sizeof(int)); ++quality_index) {
+        for (optimize_Huffman = 0; optimize_Huffman <= 1; ++optimize_Huffman) {
+            double start_time, time;
+
+            encoder.quality = benchmark_qualities[quality_index];
+            encoder.optimize_Huffman = optimize_Huffman;
+            start_time = get_time();
+            for (i = 0; i < encodes_number; ++i) {
+                if (encode_JPEG(&encoder, image.pixels, image.width, image.height, image.components_number) < 0) {
+                    PROCESS_ERROR("Couldn't encode the image at the quality %d.\n", encoder.quality);
+                }
+            }
+            time = (get_time() - start_time) / encodes_number;
+            printf("%7d %8s %11.4f %8.1f %12lu %8.3f %11.2f\n", encoder.quality,
+                   optimize_Huffman ? "optimal" : "standard", time, megapixels / time,
+                   (unsigned long) encoder.output.size, encoder.output.size * 8. / (megapixels * 1e6),
+                   get_PSNR(&image, encoder.output.buffer, encoder.output.size));
+        }
+    }
+
+    goto end;
+
+    fail:
+    ret = 1;
+
+    end:
+    if (pool_started) {
+        destroy_thread_pool(&pool);
+    }
+    destroy_jpeg_encoder(&encoder);
+    close_input_file(&input);
+
+    return ret;
+}
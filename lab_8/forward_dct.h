@@ -0,0 +1,227 @@
+/*
+ * Fixed-point forward DCT of the 8x8 block (the "islow" algorithm of Loeffler, Ligtenberg and Moschytz with
+ * 13-bit constants). The coefficients are 8 times the true DCT ones. The AVX2 version transforms all the
+ * columns at once and gives the same coefficients as the scalar one.
+ */
+
+#ifndef LAB8_FORWARD_DCT_H
+#define LAB8_FORWARD_DCT_H
+
+#include <stdint.h>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include "jpeg_tables.h"
+
+#define FDCT_CONST_BITS 13
+#define FDCT_PASS1_BITS 2
+
+#define DESCALE(x, n) (((x) + (1 << ((n) - 1))) >> (n))
+
+/*
+ * One-dimensional DCT of 8 values with the given stride. The first pass keeps FDCT_PASS1_BITS more bits
+ * of precision, the second one removes them.
+ */
+void forward_DCT_1D(int32_t *data, int stride, int pass) {
+    int even_shift = FDCT_PASS1_BITS;
+    int odd_shift = pass == 1 ? FDCT_CONST_BITS - FDCT_PASS1_BITS : FDCT_CONST_BITS + FDCT_PASS1_BITS;
+    int32_t tmp0, tmp1, tmp2, tmp3, tmp4, tmp5, tmp6, tmp7;
+    int32_t tmp10, tmp11, tmp12, tmp13;
+    int32_t z1, z2, z3, z4, z5;
+
+    tmp0 = data[0] + data[7 * stride];
+    tmp7 = data[0] - data[7 * stride];
+    tmp1 = data[stride] + data[6 * stride];
+    tmp6 = data[stride] - data[6 * stride];
+    tmp2 = data[2 * stride] + data[5 * stride];
+    tmp5 = data[2 * stride] - data[5 * stride];
+    tmp3 = data[3 * stride] + data[4 * stride];
+    tmp4 = data[3 * stride] - data[4 * stride];
+
+    /* Even part */
+    tmp10 = tmp0 + tmp3;
+    tmp13 = tmp0 - tmp3;
+    tmp11 = tmp1 + tmp2;
+    tmp12 = tmp1 - tmp2;
+
+    if (pass == 1) {
+        data[0] = (tmp10 + tmp11) * (1 << even_shift);
+        data[4 * stride] = (tmp10 - tmp11) * (1 << even_shift);
+    } else {
+        data[0] = DESCALE(tmp10 + tmp11, even_shift);
+        data[4 * stride] = DESCALE(tmp10 - tmp11, even_shift);
+    }
+
+    z1 = (tmp12 + tmp13) * FIX_0_541196100;
+    data[2 * stride] = DESCALE(z1 + tmp13 * FIX_0_765366865, odd_shift);
+    data[6 * stride] = DESCALE(z1 - tmp12 * FIX_1_847759065, odd_shift);
+
+    /* Odd part */
+    z1 = tmp4 + tmp7;
+    z2 = tmp5 + tmp6;
+    z3 = tmp4 + tmp6;
+    z4 = tmp5 + tmp7;
+    z5 = (z3 + z4) * FIX_1_175875602;
+
+    tmp4 *= FIX_0_298631336;
+    tmp5 *= FIX_2_053119869;
+    tmp6 *= FIX_3_072711026;
+    tmp7 *= FIX_1_501321110;
+    z1 *= -FIX_0_899976223;
+    z2 *= -FIX_2_562915447;
+    z3 = z3 * -FIX_1_961570560 + z5;
+    z4 = z4 * -FIX_0_390180644 + z5;
+
+    data[7 * stride] = DESCALE(tmp4 + z1 + z3, odd_shift);
+    data[5 * stride] = DESCALE(tmp5 + z2 + z4, odd_shift);
+    data[3 * stride] = DESCALE(tmp6 + z2 + z3, odd_shift);
+    data[stride] = DESCALE(tmp7 + z1 + z4, odd_shift);
+}
+
+#ifdef __AVX2__
+/*
+ * The same DCT of the eight vectors: every lane is transformed independently.
+ */
+void forward_DCT_1D_AVX2(__m256i *data, int pass) {
+    __m128i even_shift = _mm_cvtsi32_si128(FDCT_PASS1_BITS);
+    __m128i odd_shift = _mm_cvtsi32_si128(pass == 1 ? FDCT_CONST_BITS - FDCT_PASS1_BITS
+                                                    : FDCT_CONST_BITS + FDCT_PASS1_BITS);
+    __m256i even_round = _mm256_set1_epi32(1 << (FDCT_PASS1_BITS - 1));
+    __m256i odd_round = _mm256_set1_epi32(1 << ((pass == 1 ? FDCT_CONST_BITS - FDCT_PASS1_BITS
+                                                           : FDCT_CONST_BITS + FDCT_PASS1_BITS) - 1));
+    __m256i tmp0, tmp1, tmp2, tmp3, tmp4, tmp5, tmp6, tmp7;
+    __m256i tmp10, tmp11, tmp12, tmp13;
+    __m256i z1, z2, z3, z4, z5;
+
+#define MUL(x, c) _mm256_mullo_epi32(x, _mm256_set1_epi32(c))
+#define ODD_DESCALE(x) _mm256_sra_epi32(_mm256_add_epi32(x, odd_round), odd_shift)
+
+    tmp0 = _mm256_add_epi32(data[0], data[7]);
+    tmp7 = _mm256_sub_epi32(data[0], data[7]);
+    tmp1 = _mm256_add_epi32(data[1], data[6]);
+    tmp6 = _mm256_sub_epi32(data[1], data[6]);
+    tmp2 = _mm256_add_epi32(data[2], data[5]);
+    tmp5 = _mm256_sub_epi32(data[2], data[5]);
+    tmp3 = _mm256_add_epi32(data[3], data[4]);
+    tmp4 = _mm256_sub_epi32(data[3], data[4]);
+
+    /* Even part */
+    tmp10 = _mm256_add_epi32(tmp0, tmp3);
+    tmp13 = _mm256_sub_epi32(tmp0, tmp3);
+    tmp11 = _mm256_add_epi32(tmp1, tmp2);
+    tmp12 = _mm256_sub_epi32(tmp1, tmp2);
+
+    if (pass == 1) {
+        data[0] = _mm256_sll_epi32(_mm256_add_epi32(tmp10, tmp11), even_shift);
+        data[4] = _mm256_sll_epi32(_mm256_sub_epi32(tmp10, tmp11), even_shift);
+    } else {
+        data[0] = _mm256_sra_epi32(_mm256_add_epi32(_mm256_add_epi32(tmp10, tmp11), even_round), even_shift);
+        data[4] = _mm256_sra_epi32(_mm256_add_epi32(_mm256_sub_epi32(tmp10, tmp11), even_round), even_shift);
+    }
+
+    z1 = MUL(_mm256_add_epi32(tmp12, tmp13), FIX_0_541196100);
+    data[2] = ODD_DESCALE(_mm256_add_epi32(z1, MUL(tmp13, FIX_0_765366865)));
+    data[6] = ODD_DESCALE(_mm256_sub_epi32(z1, MUL(tmp12, FIX_1_847759065)));
+
+    /* Odd part */
+    z1 = _mm256_add_epi32(tmp4, tmp7);
+    z2 = _mm256_add_epi32(tmp5, tmp6);
+    z3 = _mm256_add_epi32(tmp4, tmp6);
+    z4 = _mm256_add_epi32(tmp5, tmp7);
+    z5 = MUL(_mm256_add_epi32(z3, z4), FIX_1_175875602);
+
+    tmp4 = MUL(tmp4, FIX_0_298631336);
+    tmp5 = MUL(tmp5, FIX_2_053119869);
+    tmp6 = MUL(tmp6, FIX_3_072711026);
+    tmp7 = MUL(tmp7, FIX_1_501321110);
+    z1 = MUL(z1, -FIX_0_899976223);
+    z2 = MUL(z2, -FIX_2_562915447);
+    z3 = _mm256_add_epi32(MUL(z3, -FIX_1_961570560), z5);
+    z4 = _mm256_add_epi32(MUL(z4, -FIX_0_390180644), z5);
+
+    data[7] = ODD_DESCALE(_mm256_add_epi32(_mm256_add_epi32(tmp4, z1), z3));
+    data[5] = ODD_DESCALE(_mm256_add_epi32(_mm256_add_epi32(tmp5, z2), z4));
+    data[3] = ODD_DESCALE(_mm256_add_epi32(_mm256_add_epi32(tmp6, z2), z3));
+    data[1] = ODD_DESCALE(_mm256_add_epi32(_mm256_add_epi32(tmp7, z1), z4));
+
+#undef MUL
+#undef ODD_DESCALE
+}
+
+/*
+ * Transposes the 8x8 matrix of 32-bit values held in eight vectors.
+ */
+void transpose_8x8_AVX2(__m256i *rows) {
+    __m256i t0, t1, t2, t3, t4, t5, t6, t7;
+    __m256i u0, u1, u2, u3, u4, u5, u6, u7;
+
+    t0 = _mm256_unpacklo_epi32(rows[0], rows[1]);
+    t1 = _mm256_unpackhi_epi32(rows[0], rows[1]);
+    t2 = _mm256_unpacklo_epi32(rows[2], rows[3]);
+    t3 = _mm256_unpackhi_epi32(rows[2], rows[3]);
+    t4 = _mm256_unpacklo_epi32(rows[4], rows[5]);
+    t5 = _mm256_unpackhi_epi32(rows[4], rows[5]);
+    t6 = _mm256_unpacklo_epi32(rows[6], rows[7]);
+    t7 = _mm256_unpackhi_epi32(rows[6], rows[7]);
+
+    u0 = _mm256_unpacklo_epi64(t0, t2);
+    u1 = _mm256_unpackhi_epi64(t0, t2);
+    u2 = _mm256_unpacklo_epi64(t1, t3);
+    u3 = _mm256_unpackhi_epi64(t1, t3);
+    u4 = _mm256_unpacklo_epi64(t4, t6);
+    u5 = _mm256_unpackhi_epi64(t4, t6);
+    u6 = _mm256_unpacklo_epi64(t5, t7);
+    u7 = _mm256_unpackhi_epi64(t5, t7);
+
+    rows[0] = _mm256_permute2x128_si256(u0, u4, 0x20);
+    rows[1] = _mm256_permute2x128_si256(u1, u5, 0x20);
+    rows[2] = _mm256_permute2x128_si256(u2, u6, 0x20);
+    rows[3] = _mm256_permute2x128_si256(u3, u7, 0x20);
+    rows[4] = _mm256_permute2x128_si256(u0, u4, 0x31);
+    rows[5] = _mm256_permute2x128_si256(u1, u5, 0x31);
+    rows[6] = _mm256_permute2x128_si256(u2, u6, 0x31);
+    rows[7] = _mm256_permute2x128_si256(u3, u7, 0x31);
+}
+#endif
+
+/*
+ * Transforms the level-shifted 8x8 samples at the given stride into the coefficients in the natural order.
+ * The columns are transformed first, then the rows.
+ */
+void forward_DCT(const uint8_t *samples, int stride, int32_t *coefficients) {
+#ifdef __AVX2__
+    __m256i rows[MB_H];
+    const __m256i center = _mm256_set1_epi32(128);
+    int i;
+
+    for (i = 0; i < MB_H; ++i) {
+        rows[i] = _mm256_sub_epi32(
+                _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (samples + i * stride))), center);
+    }
+    forward_DCT_1D_AVX2(rows, 1);
+    transpose_8x8_AVX2(rows);
+    forward_DCT_1D_AVX2(rows, 2);
+    transpose_8x8_AVX2(rows);
+    for (i = 0; i < MB_H; ++i) {
+        _mm256_storeu_si256((__m256i *) (coefficients + i * MB_W), rows[i]);
+    }
+#else
+    int i, j;
+
+    for (i = 0; i < MB_H; ++i) {
+        for (j = 0; j < MB_W; ++j) {
+            coefficients[i * MB_W + j] = samples[i * stride + j] - 128;
+        }
+    }
+    for (j = 0; j < MB_W; ++j) {
+        forward_DCT_1D(coefficients + j, MB_W, 1);
+    }
+    for (i = 0; i < MB_H; ++i) {
+        forward_DCT_1D(coefficients + i * MB_W, 1, 2);
+    }
+#endif
+}
+
+#endif
@@ -58,6 +58,19 @@ void add_node(Huffman_node *root, Huffman_node *node, uint16_t code_value, uint8
     }
 }
 
+/*
+ * Destroys all the codes of the tree, so the root can be reused for a redefined table.
+ */
+void clear_huffman_tree(Huffman_node *root) {
+    if (root->left_node) {
+        destroy_huffman_tree(root->left_node);
+    }
+    if (root->right_node) {
+        destroy_huffman_tree(root->right_node);
+    }
+    init_huffman_node(root, 0);
+}
+
 void build_Huffman_tree(const uint8_t *length_to_codes_number, const uint8_t *codes_values, Huffman_node *root) {
     uint16_t cur_code = 0;
     int index = 0;
@@ -101,6 +114,21 @@ void decode_value(bitstream_reader *bit_ctx, Huffman_node *node, uint16_t *resul
     decode_value_recursively(bit_ctx, node, 0, result);
 }
 
+/*
+ * Reads a value of the given bit length encoded as in JPEG: values with the leading zero are negative.
+ */
+int read_signed_value(bitstream_reader *bit_ctx, uint8_t length) {
+    int value;
+    if (length == 0) {
+        return 0;
+    }
+    value = read_bits_16bit(bit_ctx, length);
+    if (value < (1 << (length - 1))) {
+        value = value - (1 << length) + 1;
+    }
+    return value;
+}
+
 void print_Huffman_tree(Huffman_node *node, uint16_t cur_code, uint8_t cur_length) {
     if (node == NULL) {
         return;
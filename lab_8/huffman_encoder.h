@@ -0,0 +1,172 @@
+/*
+ * Huffman coding side of the JPEG encoder: code tables built from the DHT form of a table
+ * (numbers of codes of every length and the values) and the optimal tables for the gathered statistics.
+ */
+
+#ifndef LAB8_HUFFMAN_ENCODER_H
+#define LAB8_HUFFMAN_ENCODER_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include "common.h"
+#include "bitstream_writer.h"
+
+#define HUFFMAN_SYMBOLS_NUMBER 256
+#define MAX_CODE_LENGTH 16
+#define MAX_BUILD_CODE_LENGTH 32 /* code lengths before they are limited to MAX_CODE_LENGTH */
+
+typedef struct Huffman_table {
+    uint8_t length_to_codes_number[MAX_CODE_LENGTH];
+    uint8_t codes_values[HUFFMAN_SYMBOLS_NUMBER];
+    uint16_t code[HUFFMAN_SYMBOLS_NUMBER]; /* the code and its length of every value */
+    uint8_t code_length[HUFFMAN_SYMBOLS_NUMBER];
+} Huffman_table;
+
+int get_codes_number(const Huffman_table *table) {
+    int codes_number = 0;
+    int i;
+    for (i = 0; i < MAX_CODE_LENGTH; ++i) {
+        codes_number += table->length_to_codes_number[i];
+    }
+    return codes_number;
+}
+
+/*
+ * Assigns the canonical codes in the same order as build_Huffman_tree() of the decoder does.
+ */
+void build_Huffman_codes(Huffman_table *table, const uint8_t *length_to_codes_number, const uint8_t *codes_values) {
+    uint16_t cur_code = 0;
+    int index = 0;
+
+    int i, j;
+    memcpy(table->length_to_codes_number, length_to_codes_number, MAX_CODE_LENGTH);
+    memset(table->code_length, 0, sizeof(table->code_length));
+    for (i = 0; i < MAX_CODE_LENGTH; ++i) {
+        cur_code <<= 1;
+        for (j = 0; j < length_to_codes_number[i]; ++j) {
+            uint8_t value = codes_values[index];
+            table->codes_values[index++] = value;
+            table->code[value] = cur_code;
+            table->code_length[value] = (uint8_t) (i + 1);
+            ++cur_code;
+        }
+    }
+}
+
+/*
+ * Builds the optimal table limited to 16-bit codes for the frequencies of the values (ITU T.81 Annex K.2).
+ * No code consists of ones only: a reserved symbol with the frequency 1 takes it and is removed.
+ */
+void build_optimal_Huffman_table(Huffman_table *table, const uint32_t *frequencies) {
+    uint32_t frequency[HUFFMAN_SYMBOLS_NUMBER + 1];
+    int code_size[HUFFMAN_SYMBOLS_NUMBER + 1];
+    int others[HUFFMAN_SYMBOLS_NUMBER + 1];
+    uint8_t bits[MAX_BUILD_CODE_LENGTH + 1];
+    uint8_t codes_values[HUFFMAN_SYMBOLS_NUMBER];
+    int index;
+
+    int i, j;
+    for (i = 0; i < HUFFMAN_SYMBOLS_NUMBER; ++i) {
+        frequency[i] = frequencies[i];
+    }
+    frequency[HUFFMAN_SYMBOLS_NUMBER] = 1;
+    for (i = 0; i <= HUFFMAN_SYMBOLS_NUMBER; ++i) {
+        code_size[i] = 0;
+        others[i] = -1;
+    }
+
+    /* Merge the two least frequent trees until one is left, the larger value wins the ties */
+    while (1) {
+        int c1 = -1, c2 = -1;
+        uint32_t v = UINT32_MAX;
+        for (i = 0; i <= HUFFMAN_SYMBOLS_NUMBER; ++i) {
+            if (frequency[i] && frequency[i] <= v) {
+                v = frequency[i];
+                c1 = i;
+            }
+        }
+        v = UINT32_MAX;
+        for (i = 0; i <= HUFFMAN_SYMBOLS_NUMBER; ++i) {
+            if (frequency[i] && frequency[i] <= v && i != c1) {
+                v = frequency[i];
+                c2 = i;
+            }
+        }
+        if (c2 < 0) {
+            break;
+        }
+
+        frequency[c1] += frequency[c2];
+        frequency[c2] = 0;
+        ++code_size[c1];
+        while (others[c1] >= 0) {
+            c1 = others[c1];
+            ++code_size[c1];
+        }
+        others[c1] = c2;
+        ++code_size[c2];
+        while (others[c2] >= 0) {
+            c2 = others[c2];
+            ++code_size[c2];
+        }
+    }
+
+    memset(bits, 0, sizeof(bits));
+    for (i = 0; i <= HUFFMAN_SYMBOLS_NUMBER; ++i) {
+        if (code_size[i]) {
+            ++bits[MIN(code_size[i], MAX_BUILD_CODE_LENGTH)];
+        }
+    }
+
+    /* Move the codes longer than 16 bits up: a pair of them takes a shorter prefix split in two */
+    for (i = MAX_BUILD_CODE_LENGTH; i > MAX_CODE_LENGTH; --i) {
+        while (bits[i] > 0) {
+            j = i - 2;
+            while (bits[j] == 0) {
+                --j;
+            }
+            bits[i] -= 2;
+            ++bits[i - 1];
+            bits[j + 1] += 2;
+            --bits[j];
+        }
+    }
+    /* Remove the reserved symbol from the longest codes */
+    for (i = MAX_CODE_LENGTH; i > 0 && bits[i] == 0; --i);
+    if (i > 0) {
+        --bits[i];
+    }
+
+    index = 0;
+    for (i = 1; i <= MAX_BUILD_CODE_LENGTH; ++i) {
+        for (j = 0; j < HUFFMAN_SYMBOLS_NUMBER; ++j) {
+            if (MIN(code_size[j], MAX_BUILD_CODE_LENGTH) == i) {
+                codes_values[index++] = (uint8_t) j;
+            }
+        }
+    }
+    build_Huffman_codes(table, bits + 1, codes_values);
+}
+
+/*
+ * Number of bits of the magnitude of the value: the category of the DC difference or the AC coefficient.
+ */
+int get_value_length(int value) {
+    if (value < 0) {
+        value = -value;
+    }
+    return value ? 32 - __builtin_clz((unsigned int) value) : 0;
+}
+
+/*
+ * Writes the code of the symbol followed by length bits of the value, negative values are written minus one.
+ */
+void write_Huffman_value(bitstream_writer *writer, const Huffman_table *table, uint8_t symbol, int value, int length) {
+    write_bits(writer, table->code[symbol], table->code_length[symbol]);
+    if (length) {
+        write_bits(writer, (uint32_t) (value < 0 ? value - 1 : value), length);
+    }
+}
+
+#endif
@@ -0,0 +1,126 @@
+/*
+ * Whole-file input for the decoder. Regular files are memory-mapped, so the bitstream reader works right on
+ * the page cache and parsing starts without reading the file first. Pipes and stdin ("-") are read into memory.
+ */
+
+#ifndef LAB8_INPUT_FILE_H
+#define LAB8_INPUT_FILE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "common.h"
+
+#define INPUT_READ_CHUNK_SIZE (1 << 20)
+
+typedef struct input_file {
+    const uint8_t *data;
+    size_t size;
+    int mapped; /* data is the file mapping, otherwise a malloc-ed copy */
+} input_file;
+
+/*
+ * Reads the non-seekable input till its end.
+ */
+int read_input_stream(input_file *input, int fd) {
+    uint8_t *data = NULL;
+    size_t capacity = 0;
+    size_t size = 0;
+
+    while (1) {
+        ssize_t read_bytes;
+        if (size == capacity) {
+            uint8_t *new_data;
+            capacity = capacity ? capacity * 2 : INPUT_READ_CHUNK_SIZE;
+            new_data = (uint8_t *) realloc(data, capacity);
+            if (!new_data) {
+                PROCESS_ERROR("Couldn't allocate memory for the input data.\n");
+            }
+            data = new_data;
+        }
+        read_bytes = read(fd, data + size, capacity - size);
+        if (read_bytes < 0) {
+            PROCESS_ERROR("Couldn't read the input data.\n");
+        }
+        if (read_bytes == 0) {
+            break;
+        }
+        size += read_bytes;
+        if (size > MAX_INPUT_SIZE) {
+            PROCESS_ERROR("The input data is too large, it must be less than 512 MB.\n");
+        }
+    }
+
+    input->data = data;
+    input->size = size;
+    input->mapped = 0;
+    return 0;
+
+    fail:
+    free(data);
+    return -1;
+}
+
+int open_input_file(input_file *input, const char *file_name) {
+    struct stat file_stat;
+    void *mapping;
+    int fd;
+    int ret = 0;
+
+    input->data = NULL;
+    input->size = 0;
+    input->mapped = 0;
+
+    if (strcmp(file_name, "-") == 0) {
+        return read_input_stream(input, STDIN_FILENO);
+    }
+
+    fd = open(file_name, O_RDONLY);
+    if (fd < 0) {
+        PROCESS_ERROR("Couldn't open the input file \"%s\".\n", file_name);
+    }
+    if (fstat(fd, &file_stat) < 0 || !S_ISREG(file_stat.st_mode) || file_stat.st_size == 0) {
+        ret = read_input_stream(input, fd);
+        close(fd);
+        return ret;
+    }
+
+    if ((uint64_t) file_stat.st_size > MAX_INPUT_SIZE) {
+        close(fd);
+        PROCESS_ERROR("The input file \"%s\" is too large, it must be less than 512 MB.\n", file_name);
+    }
+    mapping = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); /* The mapping stays valid without the descriptor */
+    if (mapping == MAP_FAILED) {
+        PROCESS_ERROR("Couldn't map the input file \"%s\".\n", file_name);
+    }
+    /* Segments and scan data are read front to back, so the kernel can read ahead aggressively */
+    madvise(mapping, file_stat.st_size, MADV_SEQUENTIAL);
+
+    input->data = (const uint8_t *) mapping;
+    input->size = file_stat.st_size;
+    input->mapped = 1;
+    return 0;
+
+    fail:
+    return -1;
+}
+
+void close_input_file(input_file *input) {
+    if (input->mapped) {
+        munmap((void *) input->data, input->size);
+    } else {
+        free((void *) input->data);
+    }
+    input->data = NULL;
+    input->size = 0;
+    input->mapped = 0;
+}
+
+#endif
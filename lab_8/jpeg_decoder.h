@@ -0,0 +1,2342 @@
+/*
+ * Baseline and progressive JPEG decoder. All the state of a decode lives in the jpeg_decoder context,
+ * so several images can be decoded at the same time by different threads.
+ *
+ * The 12-bit frames of the extended sequential and progressive processes take their own path after
+ * the entropy decode: the integer IDCT with fewer fraction bits between the passes and the scalar upsampling
+ * and conversion of 16-bit samples.
+ * The 8-bit frames keep the vector kernels, they only pay for a branch per block and per row.
+ */
+
+#ifndef LAB8_JPEG_DECODER_H
+#define LAB8_JPEG_DECODER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+#include <pthread.h>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include "common.h"
+#include "jpeg_tables.h"
+#include "bitstream_reader.h"
+#include "huffman_decoder.h"
+#include "progressive_decoder.h"
+#include "upscale.h"
+#include "color_convert.h"
+#include "thread_pool.h"
+#include "profiler.h"
+
+#define MAX_COMPONENTS_NUMBER 4
+#define SCAN_DATA_PADDING 4
+#define DEFAULT_MAX_COEFFICIENTS_MEMORY_MB 1024
+#define STREAMED_MCU_ROWS 3 /* the row being converted and its neighbours needed by upsampling */
+#define PIPELINE_SLOTS_PER_THREAD 2 /* decoded MCU rows waiting for the transform */
+#define PIPELINE_SPIN_COUNT 1024 /* checks of a pipeline counter before the thread blocks on it */
+#define HUFFMAN_TABLES_NUMBER 4 /* of every class */
+#define QUANT_MATRICES_NUMBER 4
+
+typedef struct frame_component {
+    uint8_t id;
+    uint8_t H; // horizontal factor
+    uint8_t V; // vertical factor
+    uint8_t quant_matrix_id;
+    uint8_t table_id_DC;
+    uint8_t table_id_AC;
+    int *mb_input_data;
+    int *pipeline_coefficients; /* dequantized coefficients of the pipelined MCU rows, see pipeline_scan_data() */
+    uint8_t *plane; /* samples of the component before upscaling */
+    uint16_t plane_width;
+    uint16_t plane_height;
+    uint16_t plane_rows_stored; /* the plane is a ring buffer of this many rows */
+    upscale_tables upscale; /* used when the plane is smaller than the output */
+    int16_t *coefficients; /* quantized coefficients of the buffered frame, row by row of blocks */
+    uint16_t blocks_per_line;
+    uint16_t block_rows;
+    uint16_t scan_blocks_per_line; /* blocks covered by a non-interleaved scan */
+    uint16_t scan_block_rows;
+} frame_component;
+
+typedef struct scan_info {
+    uint8_t components_number;
+    uint8_t component_indexes[MAX_COMPONENTS_NUMBER];
+    uint8_t Ss; /* spectral selection start */
+    uint8_t Se; /* spectral selection end */
+    uint8_t Ah; /* successive approximation bit position high */
+    uint8_t Al; /* successive approximation bit position low */
+} scan_info;
+
+typedef struct scan_segment {
+    struct jpeg_decoder *decoder;
+    uint8_t *data;
+    uint32_t size;
+    uint32_t first_MCU;
+    uint32_t MCU_number;
+} scan_segment;
+
+#define SOI 0xFFD8
+#define DHT 0xFFC4
+#define DQT 0xFFDB
+#define DRI 0xFFDD
+#define SOS 0xFFDA
+#define COM 0xFFFE
+#define EOI 0xFFD9
+#define SOF0 0xFFC0
+#define SOF1 0xFFC1 /* extended sequential: the baseline with more than two tables of every class */
+#define SOF2 0xFFC2
+#define RST0 0xFFD0
+
+#define APPn_MASK 0xFFE0
+#define RSTn_MASK 0xFFF8
+
+/*
+ * Buffer of the decoder context which is kept between the decodes and only grows, so a batch of images
+ * of similar sizes allocates the large buffers once. The data is 32-byte aligned for the vector kernels.
+ */
+typedef struct recycled_buffer {
+    void *data;
+    size_t capacity;
+} recycled_buffer;
+
+/*
+ * Returns the buffer of at least size bytes, its old contents are lost when it grows.
+ */
+void *reserve_buffer(recycled_buffer *buffer, size_t size) {
+    if (size > buffer->capacity) {
+        free(buffer->data);
+        if (posix_memalign(&buffer->data, 32, size) != 0) {
+            buffer->data = NULL;
+        }
+        buffer->capacity = buffer->data ? size : 0;
+    }
+    return buffer->data;
+}
+
+void destroy_buffer(recycled_buffer *buffer) {
+    free(buffer->data);
+    buffer->data = NULL;
+    buffer->capacity = 0;
+}
+
+/*
+ * Receives rows_number consecutive output rows starting from first_row, a negative result stops the decoding.
+ * The samples of the 12-bit frame are uint16_t in the native byte order.
+ */
+typedef int (*jpeg_row_callback)(void *arg, const uint8_t *rows, uint32_t first_row, uint32_t rows_number);
+
+struct jpeg_decoder;
+
+/*
+ * Receives the quantized coefficients of the whole frame instead of the pixels: frame_component.coefficients
+ * of all the components, in the natural order. A negative result fails the decoding.
+ */
+typedef int (*jpeg_coefficients_callback)(void *arg, const struct jpeg_decoder *decoder);
+
+/*
+ * Entropy-decodes and transforms one MCU of the interleaved baseline scan.
+ */
+typedef void (*decode_MCU_function)(struct jpeg_decoder *decoder, bitstream_reader *scan_reader, uint32_t MCU_index,
+                                    int *prev_DC);
+
+typedef struct jpeg_decoder {
+    /* Options, set by the caller after init_jpeg_decoder() */
+    uint8_t scale_denominator; /* the image is decoded downscaled by 1, 2, 4 or 8 times, 8 uses only DC */
+    int max_coefficients_memory_MB;
+    int verbose;
+    int profiling; /* collect the per-stage timers and counters into profile, see profiler.h */
+    int grayscale; /* only the luma of the colour image is decoded: no chroma IDCT, upsampling or conversion */
+    thread_pool *pool; /* parallelizes the decode of one image, NULL runs everything on the calling thread */
+    jpeg_row_callback row_callback; /* NULL keeps the whole image in output_data */
+    void *row_callback_arg;
+    jpeg_coefficients_callback coefficients_callback; /* the frame is buffered and is not transformed at all */
+    void *coefficients_callback_arg;
+    uint32_t region_x; /* the region of the output pixels to decode, zero size decodes the whole image */
+    uint32_t region_y;
+    uint32_t region_width;
+    uint32_t region_height;
+
+    bitstream_reader reader;
+
+    uint16_t frame_height;
+    uint16_t frame_width;
+    uint8_t precision; /* bits of the samples: 8, or 12 for the extended sequential and progressive frames */
+    uint8_t sample_size; /* bytes of a sample of the planes and the output: 1, or 2 for the 12-bit frame */
+
+    uint8_t block_size; /* side of the decoded block in the output pixels */
+    uint16_t output_height;
+    uint16_t output_width;
+
+    /* MCUs which are transformed: the ones covering the region and their neighbours read by upsampling */
+    uint16_t window_MCU_x;
+    uint16_t window_MCU_y;
+    uint16_t window_MCU_width;
+    uint16_t window_MCU_height;
+    uint16_t window_width; /* output pixels of the window */
+    uint16_t window_height;
+    uint16_t crop_x; /* position of the region in the window */
+    uint16_t crop_y;
+    uint8_t plane_is_output; /* grayscale planes are stored right into the output rows */
+
+    uint16_t quant_matrices[QUANT_MATRICES_NUMBER][MB_SQUARE]; /* 8-bit or 16-bit entries of DQT */
+    uint16_t quant_matrices_zig_zag[QUANT_MATRICES_NUMBER][MB_SQUARE]; /* the same in the order of the scan */
+
+    frame_component *components;
+    uint8_t components_number;
+    uint8_t output_components_number; /* the first components are transformed and output, the rest are skipped */
+    uint8_t H_max;
+    uint8_t V_max;
+
+    uint16_t horizontal_MCU_number;
+    uint16_t vertical_MCU_number;
+    uint16_t restart_interval;
+
+    uint8_t progressive;
+    /* The coefficients of all the scans are kept and transformed after the last one: progressive frames and
+     * baseline frames with the non-interleaved scans */
+    uint8_t buffered;
+    uint8_t streaming; /* the baseline frame is decoded and handed to row_callback one MCU row at a time */
+    uint8_t pipelined; /* the calling thread only entropy-decodes, the pool transforms the rows of MCUs */
+    uint32_t pipeline_slots; /* decoded rows of MCUs the entropy decode can be ahead of the transform */
+    uint8_t *convert_slots; /* line and scratch buffers of the convert_MCU_row() tasks running at once */
+    uint32_t convert_slots_number;
+    size_t convert_slot_size;
+    uint32_t stored_MCU_number; /* MCUs kept in mb_input_data */
+    uint32_t streamed_MCU_rows; /* rows of MCUs kept in the planes while streaming */
+    uint32_t scans_number; /* scans of the frame read so far */
+    scan_info scan;
+    decode_MCU_function decode_MCU; /* specialised for the sampling factors of the scan */
+
+    Huffman_node *huffman_trees_AC;
+    Huffman_node *huffman_trees_DC;
+
+    uint8_t *output_data; /* interleaved output pixels of sample_size bytes per sample, owned by the decoder */
+    uint32_t output_rows_stored; /* output_data is a ring buffer of this many rows */
+    uint32_t output_origin; /* window line stored in the first row of output_data */
+
+    /* Storage of output_data and of the per-component buffers, reused by the next decode */
+    recycled_buffer output_buffer;
+    recycled_buffer coefficient_buffers[MAX_COMPONENTS_NUMBER];
+    recycled_buffer block_buffers[MAX_COMPONENTS_NUMBER]; /* mb_input_data */
+    recycled_buffer plane_buffers[MAX_COMPONENTS_NUMBER];
+    recycled_buffer pipeline_buffers[MAX_COMPONENTS_NUMBER];
+    recycled_buffer convert_buffer;
+
+    thread_pool_group tasks; /* of this decoder in the pool, which can be shared */
+    decode_profile profile; /* of the last decode */
+} jpeg_decoder;
+
+/*
+ * Thread pool task argument for the passes over the rows of MCUs.
+ */
+typedef struct MCU_row_task {
+    jpeg_decoder *decoder;
+    uint32_t MCU_row;
+} MCU_row_task;
+
+void init_jpeg_decoder(jpeg_decoder *decoder) {
+    memset(decoder, 0, sizeof(jpeg_decoder));
+    decoder->scale_denominator = 1;
+    decoder->max_coefficients_memory_MB = DEFAULT_MAX_COEFFICIENTS_MEMORY_MB;
+}
+
+void destroy_jpeg_decoder(jpeg_decoder *decoder) {
+    int k;
+
+    destroy_buffer(&decoder->output_buffer);
+    destroy_buffer(&decoder->convert_buffer);
+    for (k = 0; k < MAX_COMPONENTS_NUMBER; ++k) {
+        destroy_buffer(&decoder->coefficient_buffers[k]);
+        destroy_buffer(&decoder->block_buffers[k]);
+        destroy_buffer(&decoder->plane_buffers[k]);
+        destroy_buffer(&decoder->pipeline_buffers[k]);
+    }
+    decoder->output_data = NULL;
+}
+
+void run_task(jpeg_decoder *decoder, thread_pool_function function, void *arg) {
+    PROFILE_STAGE(decoder, STAGE_IDLE)
+    if (decoder->pool) {
+        submit_task(decoder->pool, &decoder->tasks, function, arg);
+    } else {
+        function(arg);
+    }
+}
+
+void wait_tasks(jpeg_decoder *decoder) {
+    if (decoder->pool) {
+        wait_thread_pool(decoder->pool, &decoder->tasks);
+    }
+}
+
+#define LOG_MATRIX(m) LOG_MATRIX_W_H(m, MB_W, MB_H)
+
+void parse_DQT(jpeg_decoder *decoder) {
+    uint16_t length;
+    uint16_t read_bytes;
+
+    length = read_bits_16bit(&decoder->reader, 16);
+    LOG_STDOUT("Length = %d.\n", length);
+
+    read_bytes = 2;
+    while (read_bytes < length) {
+        uint16_t *matrix_buffer;
+        uint8_t precision, matrix_id;
+
+        int i;
+
+        precision = read_bits_8bit(&decoder->reader, 4);
+        matrix_id = read_bits_8bit(&decoder->reader, 4);
+        ++read_bytes;
+
+        assert(precision == 0 || precision == 1); /* 8-bit or 16-bit entries */
+        assert(matrix_id < QUANT_MATRICES_NUMBER);
+
+        matrix_buffer = decoder->quant_matrices_zig_zag[matrix_id];
+        for (i = 0; i < MB_SQUARE; ++i) {
+            matrix_buffer[i] = precision ? read_bits_16bit(&decoder->reader, 16) : read_bits_8bit(&decoder->reader, 8);
+        }
+        read_bytes += MB_SQUARE << precision;
+
+        for (i = 0; i < MB_SQUARE; ++i) {
+            decoder->quant_matrices[matrix_id][i] = matrix_buffer[zig_zag[i]];
+        }
+        LOG_STDOUT("Read dequantization matrix with id = %d:\n", matrix_id);
+        LOG_MATRIX(decoder->quant_matrices[matrix_id])
+    }
+}
+
+/*
+ * Chooses the window of MCUs for the requested region, output_width and output_height become the region size.
+ */
+int init_window(jpeg_decoder *decoder) {
+    uint32_t MCU_output_width = decoder->H_max * decoder->block_size;
+    uint32_t MCU_output_height = decoder->V_max * decoder->block_size;
+    uint32_t x0, y0, x1, y1;
+    uint32_t MCU_x1, MCU_y1;
+
+    x0 = y0 = 0;
+    x1 = decoder->output_width;
+    y1 = decoder->output_height;
+    if (decoder->region_width != 0 && decoder->region_height != 0) {
+        if (decoder->region_x >= x1 || decoder->region_y >= y1) {
+            PROCESS_ERROR("Region (%u, %u) is outside the %dx%d image.\n",
+                          decoder->region_x, decoder->region_y, decoder->output_width, decoder->output_height);
+        }
+        x0 = decoder->region_x;
+        y0 = decoder->region_y;
+        x1 = MIN(x1, x0 + decoder->region_width);
+        y1 = MIN(y1, y0 + decoder->region_height);
+    }
+
+    /* One more MCU on every side, so the border pixels of the region are upsampled from the real neighbours */
+    decoder->window_MCU_x = x0 / MCU_output_width > 0 ? x0 / MCU_output_width - 1 : 0;
+    decoder->window_MCU_y = y0 / MCU_output_height > 0 ? y0 / MCU_output_height - 1 : 0;
+    MCU_x1 = MIN((x1 - 1) / MCU_output_width + 2, decoder->horizontal_MCU_number);
+    MCU_y1 = MIN((y1 - 1) / MCU_output_height + 2, decoder->vertical_MCU_number);
+    decoder->window_MCU_width = MCU_x1 - decoder->window_MCU_x;
+    decoder->window_MCU_height = MCU_y1 - decoder->window_MCU_y;
+    decoder->window_width = decoder->window_MCU_width * MCU_output_width;
+    decoder->window_height = decoder->window_MCU_height * MCU_output_height;
+    decoder->crop_x = x0 - decoder->window_MCU_x * MCU_output_width;
+    decoder->crop_y = y0 - decoder->window_MCU_y * MCU_output_height;
+
+    decoder->output_width = x1 - x0;
+    decoder->output_height = y1 - y0;
+    /* The luma plane of the grayscale output is the output itself when it isn't upscaled */
+    decoder->plane_is_output = decoder->output_components_number == 1 && decoder->crop_x == 0 && decoder->crop_y == 0 &&
+                               decoder->components[0].H == decoder->H_max && decoder->components[0].V == decoder->V_max;
+    return 0;
+
+    fail:
+    return -1;
+}
+
+int parse_SOF(jpeg_decoder *decoder) {
+    uint16_t length;
+    uint8_t precision;
+    uint16_t MCU_width;
+    uint16_t MCU_height;
+
+    int i;
+
+    length = read_bits_16bit(&decoder->reader, 16);
+    LOG_STDOUT("Length = %d.\n", length);
+    (void) length; /* only logged */
+
+    precision = read_bits_8bit(&decoder->reader, 8);
+    assert(precision == 8 || precision == 12);
+    decoder->precision = precision;
+    decoder->sample_size = precision > 8 ? 2 : 1;
+
+    decoder->frame_height = read_bits_16bit(&decoder->reader, 16);
+    decoder->frame_width = read_bits_16bit(&decoder->reader, 16);
+    LOG_STDOUT("Width = %d, Height = %d.\n", decoder->frame_width, decoder->frame_height);
+
+    decoder->components_number = read_bits_8bit(&decoder->reader, 8);
+    assert(decoder->components_number == 1 || decoder->components_number == 3);
+    decoder->scans_number = 0;
+
+    decoder->block_size = MB_W / decoder->scale_denominator;
+    decoder->output_width = (decoder->frame_width + decoder->scale_denominator - 1) / decoder->scale_denominator;
+    decoder->output_height = (decoder->frame_height + decoder->scale_denominator - 1) / decoder->scale_denominator;
+
+    decoder->components = (frame_component *) malloc(decoder->components_number * sizeof(frame_component));
+    if (!decoder->components) {
+        PROCESS_ERROR("Couldn't allocate memory for the frame components.\n");
+    }
+    decoder->H_max = decoder->V_max = 0;
+
+    for (i = 0; i < decoder->components_number; ++i) {
+        uint8_t H, V;
+        decoder->components[i].id = read_bits_8bit(&decoder->reader, 8);
+        H = read_bits_8bit(&decoder->reader, 4);
+        V = read_bits_8bit(&decoder->reader, 4);
+        assert(H >= 1 && H <= 4);
+        assert(V >= 1 && V <= 4);
+        if (decoder->components_number == 1) { /* The only component is always scanned block by block */
+            H = V = 1;
+        }
+        decoder->H_max = MAX(decoder->H_max, H);
+        decoder->V_max = MAX(decoder->V_max, V);
+        decoder->components[i].H = H;
+        decoder->components[i].V = V;
+        decoder->components[i].quant_matrix_id = read_bits_8bit(&decoder->reader, 8);
+        LOG_STDOUT("Read %d-th component info: id = %d, H = %d, V = %d, quant_matrix_id = %d.\n",
+                   i + 1, decoder->components[i].id, H, V, decoder->components[i].quant_matrix_id);
+    }
+
+    decoder->output_components_number = decoder->grayscale ? 1 : decoder->components_number;
+
+    MCU_height = decoder->V_max * MB_H;
+    MCU_width = decoder->H_max * MB_W;
+    /* The edge MCUs are padded, the padding is decoded but cropped on output */
+    decoder->horizontal_MCU_number = (decoder->frame_width + MCU_width - 1) / MCU_width;
+    decoder->vertical_MCU_number = (decoder->frame_height + MCU_height - 1) / MCU_height;
+
+    if (init_window(decoder) < 0) {
+        goto fail;
+    }
+
+    for (i = 0; i < decoder->components_number; ++i) {
+        frame_component *component = &decoder->components[i];
+        uint32_t width_i = (decoder->frame_width * component->H + decoder->H_max - 1) / decoder->H_max;
+        uint32_t height_i = (decoder->frame_height * component->V + decoder->V_max - 1) / decoder->V_max;
+        component->blocks_per_line = decoder->horizontal_MCU_number * component->H;
+        component->block_rows = decoder->vertical_MCU_number * component->V;
+        component->scan_blocks_per_line = (width_i + MB_W - 1) / MB_W;
+        component->scan_block_rows = (height_i + MB_H - 1) / MB_H;
+        component->coefficients = NULL;
+    }
+
+    return 0;
+
+    fail:
+    return -1;
+}
+
+uint32_t get_restart_intervals_number(const jpeg_decoder *decoder) {
+    uint32_t MCU_number = decoder->horizontal_MCU_number * decoder->vertical_MCU_number;
+    return decoder->restart_interval ? (MCU_number + decoder->restart_interval - 1) / decoder->restart_interval : 1;
+}
+
+/*
+ * Allocates the buffers of the frame when its first scan is read: only then it is known whether the baseline
+ * frame is interleaved, the non-interleaved one is buffered like the progressive frame.
+ */
+int start_frame(jpeg_decoder *decoder) {
+    size_t coefficients_memory;
+    int i;
+
+    decoder->buffered = decoder->progressive || decoder->scan.components_number != decoder->components_number ||
+                        decoder->coefficients_callback;
+    /* Only the buffered frame needs all the coefficients before the first row can be output */
+    decoder->streaming = decoder->row_callback && !decoder->buffered;
+    /* The restart intervals are decoded in parallel when there are enough of them, otherwise one thread
+     * entropy-decodes and the pool transforms. The streamed frame is always decoded in order. */
+    decoder->pipelined = !decoder->buffered && decoder->block_size > 1 && decoder->pool &&
+                         decoder->pool->threads_number > 1 &&
+                         (decoder->streaming ||
+                          get_restart_intervals_number(decoder) < (uint32_t) decoder->pool->threads_number);
+    decoder->pipeline_slots = decoder->pipelined ? PIPELINE_SLOTS_PER_THREAD * decoder->pool->threads_number : 0;
+    if (decoder->streaming) {
+        /* The pipelined rows are converted in order, the slots ahead of the converted row are being transformed */
+        decoder->stored_MCU_number = decoder->window_MCU_width * (decoder->pipelined ? decoder->pipeline_slots : 1);
+        decoder->streamed_MCU_rows = decoder->pipelined ? decoder->pipeline_slots + 1 : STREAMED_MCU_ROWS;
+        /* Grayscale output rows are the plane rows, so they live as long as the plane ones */
+        decoder->output_rows_stored = (decoder->plane_is_output ? decoder->streamed_MCU_rows : 1) *
+                                      decoder->V_max * decoder->block_size;
+        decoder->output_origin = 0;
+    } else {
+        decoder->stored_MCU_number = decoder->window_MCU_width * decoder->window_MCU_height;
+        decoder->output_rows_stored = decoder->output_height;
+        decoder->output_origin = decoder->crop_y;
+    }
+    if (!decoder->coefficients_callback) {
+        decoder->output_data = (uint8_t *) reserve_buffer(&decoder->output_buffer,
+                (size_t) decoder->output_components_number * decoder->output_width * decoder->output_rows_stored *
+                decoder->sample_size);
+        if (!decoder->output_data) {
+            PROCESS_ERROR("Couldn't allocate memory for the output pixels.\n");
+        }
+    }
+
+    if (!decoder->buffered) {
+        return 0;
+    }
+
+    /* All the scans fill the same coefficients, so they are kept for the whole frame */
+    coefficients_memory = 0;
+    for (i = 0; i < decoder->components_number; ++i) {
+        frame_component *component = &decoder->components[i];
+        coefficients_memory += (size_t) component->blocks_per_line * component->block_rows * MB_SQUARE * sizeof(int16_t);
+    }
+    if (decoder->verbose) {
+        fprintf(stderr, "Frame coefficient buffers: %lu KB (limit is %d MB).\n",
+                (unsigned long) (coefficients_memory >> 10), decoder->max_coefficients_memory_MB);
+    }
+    if (coefficients_memory > ((size_t) decoder->max_coefficients_memory_MB << 20)) {
+        PROCESS_ERROR("Frame needs %lu MB of coefficient buffers, the limit is %d MB.\n",
+                      (unsigned long) (coefficients_memory >> 20), decoder->max_coefficients_memory_MB);
+    }
+    for (i = 0; i < decoder->components_number; ++i) {
+        frame_component *component = &decoder->components[i];
+        size_t size = (size_t) component->blocks_per_line * component->block_rows * MB_SQUARE * sizeof(int16_t);
+        component->coefficients = (int16_t *) reserve_buffer(&decoder->coefficient_buffers[i], size);
+        if (!component->coefficients) {
+            PROCESS_ERROR("Couldn't allocate memory for the coefficients of the component %d.\n", component->id);
+        }
+        memset(component->coefficients, 0, size);
+    }
+    return 0;
+
+    fail:
+    return -1;
+}
+
+void parse_DHT(jpeg_decoder *decoder) {
+    uint16_t length;
+    uint16_t read_bytes;
+
+    length = read_bits_16bit(&decoder->reader, 16);
+    LOG_STDOUT("Length = %d.\n", length);
+
+    read_bytes = 2;
+    while (read_bytes < length) {
+        uint8_t length_to_codes_number[16];
+        uint8_t table_class;
+        uint8_t table_id;
+        int i;
+        int codes_number;
+        uint8_t *codes_values;
+        Huffman_node *root;
+
+        table_class = read_bits_8bit(&decoder->reader, 4);
+        table_id = read_bits_8bit(&decoder->reader, 4);
+        ++read_bytes;
+
+        assert(table_class <= 1);
+        assert(table_id < HUFFMAN_TABLES_NUMBER);
+
+        copy_from_buffer(&decoder->reader, length_to_codes_number, 16);
+        read_bytes += 16;
+
+        LOG_STDOUT("Read %s Huffman Table with id %d:\n", table_class ? "AC" : "DC", table_id);
+        LOG_STDOUT("Code-Length - Number-of-codes_number: ");
+        codes_number = 0;
+        for (i = 0; i < 16; ++i) {
+            LOG_STDOUT("%d-%d ", i + 1, length_to_codes_number[i]);
+            codes_number += length_to_codes_number[i];
+        }
+        LOG_STDOUT("\n");
+
+        codes_values = (uint8_t *) malloc(codes_number * sizeof(uint8_t));
+        copy_from_buffer(&decoder->reader, codes_values, codes_number);
+        read_bytes += codes_number;
+
+        LOG_STDOUT("Codes-Values: ");
+        for (i = 0; i < codes_number; ++i) {
+            LOG_STDOUT("%X ", codes_values[i]);
+        }
+        LOG_STDOUT("\n");
+
+        if (table_class == 1) {
+            root = &decoder->huffman_trees_AC[table_id];
+        } else {
+            root = &decoder->huffman_trees_DC[table_id];
+        }
+        clear_huffman_tree(root); /* Progressive images may redefine the tables between scans */
+        build_Huffman_tree(length_to_codes_number, codes_values, root);
+
+        LOG_STDOUT("Resulting Huffman Tree:\n");
+        print_Huffman_tree(root, 0, 0);
+        LOG_STDOUT("\n");
+
+        free(codes_values);
+    }
+}
+
+void parse_DRI(jpeg_decoder *decoder) {
+    uint16_t length;
+
+    length = read_bits_16bit(&decoder->reader, 16);
+    LOG_STDOUT("Length = %d.\n", length);
+    assert(length == 4);
+
+    decoder->restart_interval = read_bits_16bit(&decoder->reader, 16);
+    LOG_STDOUT("Restart interval = %d MCUs.\n", decoder->restart_interval);
+}
+
+uint8_t *filter_scan_data(jpeg_decoder *decoder, uint32_t *new_buffer_size, uint32_t *full_size) {
+    uint32_t cur_index = get_current_position(&decoder->reader);
+    uint32_t end_index = find_next_marker_position(&decoder->reader);
+    const uint8_t *buffer = get_buffer(&decoder->reader);
+    uint8_t *new_buffer;
+    size_t FF00_number;
+    uint32_t i;
+
+    assert((cur_index & 7) == 0);
+    assert((end_index & 7) == 0);
+    FF00_number = 0;
+    for (i = cur_index; i < end_index; i += 8) {
+        if (buffer[i >> 3] == 0xFF && buffer[(i >> 3) + 1] == 0x00) {
+            ++FF00_number;
+        }
+    }
+    *full_size = (end_index - cur_index) >> 3;
+    *new_buffer_size = *full_size - FF00_number;
+    /* Padding lets the bit reader look a few bytes past the end of the segment */
+    new_buffer = (uint8_t *) calloc(*new_buffer_size + SCAN_DATA_PADDING, sizeof(uint8_t));
+    if (!new_buffer) {
+        return NULL;
+    }
+    for (i = 0; i < *new_buffer_size; ++i) {
+        new_buffer[i] = buffer[cur_index >> 3];
+        if (buffer[cur_index >> 3] == 0xFF && buffer[(cur_index >> 3) + 1] == 0x00) {
+            cur_index += 8;
+        }
+        cur_index += 8;
+    }
+    return new_buffer;
+}
+
+/*
+ * Zeroes the 32-byte aligned block.
+ */
+void clear_block(int *block) {
+#ifdef __AVX2__
+    const __m256i zero = _mm256_setzero_si256();
+    int i;
+    for (i = 0; i < MB_SQUARE; i += 8) {
+        _mm256_store_si256((__m256i *) (block + i), zero);
+    }
+#else
+    memset(block, 0, MB_SQUARE * sizeof(int));
+#endif
+}
+
+/*
+ * Whether any AC coefficient of the 32-byte aligned block is not zero.
+ */
+int has_AC_coefficients(const int *block) {
+#ifdef __AVX2__
+    __m256i bits = _mm256_blend_epi32(_mm256_load_si256((const __m256i *) block), _mm256_setzero_si256(), 0x01);
+    int i;
+    for (i = 8; i < MB_SQUARE; i += 8) {
+        bits = _mm256_or_si256(bits, _mm256_load_si256((const __m256i *) (block + i)));
+    }
+    return !_mm256_testz_si256(bits, bits);
+#else
+    int i;
+    for (i = 1; i < MB_SQUARE; ++i) {
+        if (block[i] != 0) {
+            return 1;
+        }
+    }
+    return 0;
+#endif
+}
+
+/*
+ * Decodes the block into the natural order of the coefficients and dequantizes them on the way:
+ * quant_matrix is in the order of the scan, so only the coefficients present in the stream are touched
+ * after the block is cleared. The block must be 32-byte aligned.
+ */
+void decode_macroblock(bitstream_reader *scan_reader, int *block, Huffman_node *huffman_tree_DC,
+                       Huffman_node *huffman_tree_AC, const uint16_t *quant_matrix, int *prev_DC) {
+    uint16_t DC_length;
+    int i;
+
+    clear_block(block);
+
+    decode_value(scan_reader, huffman_tree_DC, &DC_length);
+    *prev_DC += read_signed_value(scan_reader, DC_length); /* Add the previous DC coefficient */
+    block[0] = *prev_DC * quant_matrix[0];
+
+    i = 1;
+    while (i < MB_SQUARE) {
+        uint16_t x;
+
+        decode_value(scan_reader, huffman_tree_AC, &x);
+        if (x == 0) { /* EOB: the rest of the block is zero */
+            break;
+        }
+        i += (x & 0xF0) >> 4; /* Zero run */
+        block[reverse_zig_zag[i]] = read_signed_value(scan_reader, x & 0x0F) * quant_matrix[i];
+        ++i;
+    }
+}
+
+/*
+ * Decodes only the DC difference of the block. The AC codes are parsed to get to the next block,
+ * but the coefficients are not stored.
+ */
+int decode_macroblock_DC(bitstream_reader *scan_reader, Huffman_node *huffman_tree_DC, Huffman_node *huffman_tree_AC) {
+    uint16_t DC_length;
+    int DC_value;
+    int i;
+    decode_value(scan_reader, huffman_tree_DC, &DC_length);
+    DC_value = read_signed_value(scan_reader, DC_length);
+
+    i = 1;
+    while (i < MB_SQUARE) {
+        uint16_t x;
+        decode_value(scan_reader, huffman_tree_AC, &x);
+        if (x == 0) {
+            break;
+        }
+        i += ((x & 0xF0) >> 4) + 1;
+        skip_bits(scan_reader, x & 0x0F);
+    }
+    return DC_value;
+}
+
+/*
+ * The 1x1 block of the 1/8 scale: the average of the block, which is what the reduced IDCT of the DC gives.
+ */
+int get_DC_sample(int DC, const uint16_t *quant_matrix) {
+    return DC * quant_matrix[0] / MB_W;
+}
+
+void dequantization(int *mb_data, const uint16_t *quant_matrix) {
+    int k;
+    for (k = 0; k < MB_SQUARE; ++k) {
+        mb_data[k] *= quant_matrix[k];
+    }
+}
+
+static double IDCT_TABLE_4[MB_H / 2][MB_W / 2];
+static double IDCT_TABLE_2[MB_H / 4][MB_W / 4];
+static pthread_once_t IDCT_tables_once = PTHREAD_ONCE_INIT;
+
+double IDCT_table_value(int i, int j, int size) {
+    double C_i;
+    if (i == 0) {
+        C_i = sqrt(2) / 2.;
+    } else {
+        C_i = 1.;
+    }
+    return C_i * cos(((2 * j + 1) * i * M_PI) / (2 * size));
+}
+
+void fill_IDCT_table() {
+    int i, j;
+    for (i = 0; i < MB_H / 2; ++i) {
+        for (j = 0; j < MB_W / 2; ++j) {
+            IDCT_TABLE_4[i][j] = IDCT_table_value(i, j, MB_W / 2);
+        }
+    }
+    for (i = 0; i < MB_H / 4; ++i) {
+        for (j = 0; j < MB_W / 4; ++j) {
+            IDCT_TABLE_2[i][j] = IDCT_table_value(i, j, MB_W / 4);
+        }
+    }
+}
+
+/*
+ * The tables are shared by all the decoders, so they are filled only once.
+ */
+void init_IDCT_tables() {
+    pthread_once(&IDCT_tables_once, fill_IDCT_table);
+}
+
+/*
+ * Extra bits of precision kept between the passes of the integer IDCT. The 12-bit coefficients keep only one,
+ * so the products of the second pass fit into 32 bits.
+ */
+#define IDCT_CONST_BITS 13
+#define IDCT_PASS1_BITS_8 2
+#define IDCT_PASS1_BITS_12 1
+
+#define IDCT_DESCALE(x, n) (((x) + ((int32_t) 1 << ((n) - 1))) >> (n))
+
+/*
+ * One 8-point pass of the integer IDCT (Loeffler, Ligtenberg and Moschytz, the one of libjpeg's islow):
+ * in[k * step] are the coefficients, out[k * step] the samples descaled by shift bits.
+ */
+#define IDCT_INT32_PASS(in, out, step, shift) { \
+    int32_t z1, z2, z3, z4, z5; \
+    int32_t tmp0, tmp1, tmp2, tmp3, tmp10, tmp11, tmp12, tmp13; \
+    /* Even part */ \
+    z2 = (in)[2 * (step)]; \
+    z3 = (in)[6 * (step)]; \
+    z1 = (z2 + z3) * FIX_0_541196100; \
+    tmp2 = z1 - z3 * FIX_1_847759065; \
+    tmp3 = z1 + z2 * FIX_0_765366865; \
+    tmp0 = ((int32_t) (in)[0] + (in)[4 * (step)]) * (1 << IDCT_CONST_BITS); \
+    tmp1 = ((int32_t) (in)[0] - (in)[4 * (step)]) * (1 << IDCT_CONST_BITS); \
+    tmp10 = tmp0 + tmp3; \
+    tmp13 = tmp0 - tmp3; \
+    tmp11 = tmp1 + tmp2; \
+    tmp12 = tmp1 - tmp2; \
+    /* Odd part */ \
+    tmp0 = (in)[7 * (step)]; \
+    tmp1 = (in)[5 * (step)]; \
+    tmp2 = (in)[3 * (step)]; \
+    tmp3 = (in)[1 * (step)]; \
+    z1 = tmp0 + tmp3; \
+    z2 = tmp1 + tmp2; \
+    z3 = tmp0 + tmp2; \
+    z4 = tmp1 + tmp3; \
+    z5 = (z3 + z4) * FIX_1_175875602; \
+    tmp0 *= FIX_0_298631336; \
+    tmp1 *= FIX_2_053119869; \
+    tmp2 *= FIX_3_072711026; \
+    tmp3 *= FIX_1_501321110; \
+    z1 *= -FIX_0_899976223; \
+    z2 *= -FIX_2_562915447; \
+    z3 = z3 * -FIX_1_961570560 + z5; \
+    z4 = z4 * -FIX_0_390180644 + z5; \
+    tmp0 += z1 + z3; \
+    tmp1 += z2 + z4; \
+    tmp2 += z2 + z3; \
+    tmp3 += z1 + z4; \
+    (out)[0] = IDCT_DESCALE(tmp10 + tmp3, shift); \
+    (out)[7 * (step)] = IDCT_DESCALE(tmp10 - tmp3, shift); \
+    (out)[1 * (step)] = IDCT_DESCALE(tmp11 + tmp2, shift); \
+    (out)[6 * (step)] = IDCT_DESCALE(tmp11 - tmp2, shift); \
+    (out)[2 * (step)] = IDCT_DESCALE(tmp12 + tmp1, shift); \
+    (out)[5 * (step)] = IDCT_DESCALE(tmp12 - tmp1, shift); \
+    (out)[3 * (step)] = IDCT_DESCALE(tmp13 + tmp0, shift); \
+    (out)[4 * (step)] = IDCT_DESCALE(tmp13 - tmp0, shift); \
+}
+
+/*
+ * Separable integer IDCT in 32-bit arithmetic: the 16 passes of 8 points need a few multiplications per sample.
+ * pass1_bits is IDCT_PASS1_BITS_8 or IDCT_PASS1_BITS_12 by the precision of the frame.
+ * The samples are not clamped here, storing them into the planes does it.
+ */
+void IDCT(const int *matrix, int *output, int pass1_bits) {
+    int32_t workspace[MB_SQUARE];
+    int i;
+
+    for (i = 0; i < MB_W; ++i) { /* Columns */
+        IDCT_INT32_PASS(matrix + i, workspace + i, MB_W, IDCT_CONST_BITS - pass1_bits)
+    }
+    for (i = 0; i < MB_H; ++i) { /* Rows, the 8 x 8 transform has the extra factor of 8 */
+        IDCT_INT32_PASS(workspace + i * MB_W, output + i * MB_W, 1, IDCT_CONST_BITS + pass1_bits + 3)
+    }
+}
+
+#undef IDCT_INT32_PASS
+#undef IDCT_DESCALE
+
+/*
+ * Reduced IDCT: only size x size low-frequency coefficients are transformed, which gives the block
+ * downscaled by MB_W / size times. The output is written with the row stride equal to size.
+ */
+void scaled_IDCT(const int *matrix, int *output, int size) {
+    const double *table = size == MB_W / 2 ? IDCT_TABLE_4[0] : IDCT_TABLE_2[0];
+    double rows[MB_SQUARE / 4];
+    int x, y, u, v;
+
+    if (size == 1) { /* Only DC: the block average */
+        output[0] = (int) (matrix[0] / 8.);
+        return;
+    }
+
+    for (v = 0; v < size; ++v) {
+        for (x = 0; x < size; ++x) {
+            double sum = 0;
+            for (u = 0; u < size; ++u) {
+                sum += matrix[v * MB_W + u] * table[u * size + x];
+            }
+            rows[v * size + x] = sum;
+        }
+    }
+    for (y = 0; y < size; ++y) {
+        for (x = 0; x < size; ++x) {
+            double sum = 0;
+            for (v = 0; v < size; ++v) {
+                sum += rows[v * size + x] * table[v * size + y];
+            }
+            output[y * size + x] = (int) (sum / 4.);
+        }
+    }
+}
+
+/*
+ * Transforms the dequantized coefficients into the block_size x block_size samples of mb_data.
+ * The 12-bit frames keep less precision between the IDCT passes, the reduced IDCT works for any precision.
+ */
+void transform_block(const int *coefficients, int *mb_data, uint8_t block_size, uint8_t precision) {
+    if (block_size == MB_W) {
+        IDCT(coefficients, mb_data, precision == 8 ? IDCT_PASS1_BITS_8 : IDCT_PASS1_BITS_12);
+    } else {
+        scaled_IDCT(coefficients, mb_data, block_size);
+    }
+}
+
+int allocate_mb_input_data(jpeg_decoder *decoder) {
+    int block_square = decoder->block_size * decoder->block_size;
+    int k;
+    for (k = 0; k < decoder->output_components_number; ++k) {
+        frame_component *component = &decoder->components[k];
+        component->mb_input_data = (int *) reserve_buffer(&decoder->block_buffers[k],
+                (size_t) decoder->stored_MCU_number * component->H * component->V * block_square * sizeof(int));
+        if (!component->mb_input_data) {
+            PROCESS_ERROR("Couldn't allocate memory for the macroblocks of the component %d.\n", component->id);
+        }
+    }
+    return 0;
+
+    fail:
+    return -1;
+}
+
+int is_MCU_in_window(const jpeg_decoder *decoder, uint32_t MCU_index) {
+    uint32_t MCU_row = MCU_index / decoder->horizontal_MCU_number;
+    uint32_t MCU_col = MCU_index % decoder->horizontal_MCU_number;
+    return MCU_row >= decoder->window_MCU_y && MCU_row < decoder->window_MCU_y + decoder->window_MCU_height &&
+           MCU_col >= decoder->window_MCU_x && MCU_col < decoder->window_MCU_x + decoder->window_MCU_width;
+}
+
+/*
+ * Whether any of the MCUs [first_MCU, first_MCU + MCU_number) is in the window.
+ */
+int window_intersects(const jpeg_decoder *decoder, uint32_t first_MCU, uint32_t MCU_number) {
+    uint32_t last_MCU = first_MCU + MCU_number - 1;
+    uint32_t MCU_row = MAX(first_MCU / decoder->horizontal_MCU_number, decoder->window_MCU_y);
+    uint32_t last_row = MIN(last_MCU / decoder->horizontal_MCU_number,
+                            (uint32_t) (decoder->window_MCU_y + decoder->window_MCU_height - 1));
+
+    for (; MCU_row <= last_row; ++MCU_row) {
+        uint32_t row_start = MCU_row * decoder->horizontal_MCU_number;
+        uint32_t first_col = MAX(first_MCU, row_start) - row_start;
+        uint32_t last_col = MIN(last_MCU, row_start + decoder->horizontal_MCU_number - 1) - row_start;
+        if (first_col < decoder->window_MCU_x + decoder->window_MCU_width && last_col >= decoder->window_MCU_x) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Decoded blocks of the component in the window MCU, the MCUs are stored in a ring of stored_MCU_number.
+ */
+int *get_MCU_blocks(const jpeg_decoder *decoder, const frame_component *component, uint32_t MCU_index) {
+    int block_square = decoder->block_size * decoder->block_size;
+    uint32_t MCU_row = MCU_index / decoder->horizontal_MCU_number - decoder->window_MCU_y;
+    uint32_t MCU_col = MCU_index % decoder->horizontal_MCU_number - decoder->window_MCU_x;
+    uint32_t stored_index = (MCU_row * decoder->window_MCU_width + MCU_col) % decoder->stored_MCU_number;
+    return component->mb_input_data + stored_index * component->H * component->V * block_square;
+}
+
+/*
+ * Dequantized coefficients of the component in the window MCU, waiting in the pipeline for the transform.
+ * The rows of MCUs are stored in a ring of pipeline_slots.
+ */
+int *get_MCU_coefficients(const jpeg_decoder *decoder, const frame_component *component, uint32_t MCU_index) {
+    uint32_t MCU_row = MCU_index / decoder->horizontal_MCU_number - decoder->window_MCU_y;
+    uint32_t MCU_col = MCU_index % decoder->horizontal_MCU_number - decoder->window_MCU_x;
+    uint32_t slot = MCU_row % decoder->pipeline_slots;
+    return component->pipeline_coefficients +
+           (slot * decoder->window_MCU_width + MCU_col) * component->H * component->V * MB_SQUARE;
+}
+
+uint8_t *get_plane_row(const frame_component *component, uint32_t row) {
+    return component->plane + (row % component->plane_rows_stored) * component->plane_width;
+}
+
+/*
+ * Plane row of the 12-bit frame, its samples are 16-bit.
+ */
+uint16_t *get_plane_row_16(const frame_component *component, uint32_t row) {
+    return (uint16_t *) component->plane + (row % component->plane_rows_stored) * component->plane_width;
+}
+
+/*
+ * Output row of the window line.
+ */
+uint8_t *get_output_row(const jpeg_decoder *decoder, uint32_t line) {
+    uint32_t stored_row = (line - decoder->output_origin) % decoder->output_rows_stored;
+    return decoder->output_data +
+           stored_row * decoder->output_width * decoder->output_components_number * decoder->sample_size;
+}
+
+/*
+ * Splits the scan data into restart intervals: every interval is unstuffed into its own buffer,
+ * so the intervals can be entropy-decoded independently.
+ */
+int split_scan_data(jpeg_decoder *decoder, scan_segment **segments_ptr, uint32_t *segments_number_ptr,
+                    uint32_t MCU_number) {
+    uint32_t interval = decoder->restart_interval ? decoder->restart_interval : MCU_number;
+    uint32_t segments_number = (MCU_number + interval - 1) / interval;
+    scan_segment *segments = (scan_segment *) malloc(segments_number * sizeof(scan_segment));
+    uint32_t last_MCU = MCU_number;
+    uint32_t s;
+
+    if (!segments) {
+        PROCESS_ERROR("Couldn't allocate memory for the restart intervals.\n");
+    }
+
+    if (!decoder->buffered) { /* Nothing after the last MCU of the window has to be decoded */
+        last_MCU = (decoder->window_MCU_y + decoder->window_MCU_height - 1) * decoder->horizontal_MCU_number +
+                   decoder->window_MCU_x + decoder->window_MCU_width;
+    }
+
+    for (s = 0; s < segments_number; ++s) {
+        uint32_t full_size;
+        if (s != 0) {
+            uint16_t marker = read_bits_16bit(&decoder->reader, 16);
+            assert((marker & RSTn_MASK) == RST0);
+            LOG_STDOUT("%X: Restart marker (RST%d) was read.\n", marker, marker & ~RSTn_MASK);
+        }
+        segments[s].decoder = decoder;
+        segments[s].first_MCU = s * interval;
+        segments[s].MCU_number = s * interval < last_MCU ? MIN(interval, last_MCU - s * interval) : 0;
+        if (!decoder->buffered && segments[s].MCU_number != 0 &&
+            !window_intersects(decoder, segments[s].first_MCU, segments[s].MCU_number)) {
+            segments[s].MCU_number = 0;
+        }
+        if (segments[s].MCU_number == 0) { /* The interval is outside the region: jump to the next marker */
+            segments[s].data = NULL;
+            segments[s].size = 0;
+            skip_bits(&decoder->reader, find_next_marker_position(&decoder->reader) -
+                                        get_current_position(&decoder->reader));
+            continue;
+        }
+        PROFILE_STAGE(decoder, STAGE_FILTER_SCAN_DATA)
+        segments[s].data = filter_scan_data(decoder, &segments[s].size, &full_size);
+        if (!segments[s].data) {
+            while (s-- > 0) {
+                free(segments[s].data);
+            }
+            free(segments);
+            PROCESS_ERROR("Couldn't allocate memory for the scan data.\n");
+        }
+        PROFILE_STAGE(decoder, STAGE_MARKERS)
+        skip_bits(&decoder->reader, full_size << 3);
+    }
+
+    *segments_ptr = segments;
+    *segments_number_ptr = segments_number;
+    return 0;
+
+    fail:
+    return -1;
+}
+
+/*
+ * Decodes one block of the interleaved baseline scan into mb_data, NULL for the block outside of the window.
+ * The pipelined decode leaves the 32-byte aligned dequantized coefficients in mb_data for the transform.
+ */
+void decode_MCU_block(jpeg_decoder *decoder, bitstream_reader *scan_reader, const frame_component *component,
+                      int *mb_data, int *prev_DC) {
+    int coefficients[MB_SQUARE] ALIGNED(32);
+    Huffman_node *huffman_tree_DC = &decoder->huffman_trees_DC[component->table_id_DC];
+    Huffman_node *huffman_tree_AC = &decoder->huffman_trees_AC[component->table_id_AC];
+
+    /* Outside of the window only the DC prediction has to be followed, and the thumbnail needs only DC:
+     * no AC coefficients and no IDCT */
+    PROFILE_BLOCK_STAGE(decoder, STAGE_ENTROPY_DECODE, 1)
+    if (!mb_data || decoder->block_size == 1) {
+        *prev_DC += decode_macroblock_DC(scan_reader, huffman_tree_DC, huffman_tree_AC);
+        if (mb_data) {
+            mb_data[0] = get_DC_sample(*prev_DC, decoder->quant_matrices[component->quant_matrix_id]);
+            PROFILE_DC_ONLY_BLOCK(decoder)
+        }
+        return;
+    }
+    if (decoder->pipelined) {
+        decode_macroblock(scan_reader, mb_data, huffman_tree_DC, huffman_tree_AC,
+                          decoder->quant_matrices_zig_zag[component->quant_matrix_id], prev_DC);
+        PROFILE_BLOCK(decoder, !has_AC_coefficients(mb_data))
+        return;
+    }
+
+    decode_macroblock(scan_reader, coefficients, huffman_tree_DC, huffman_tree_AC,
+                      decoder->quant_matrices_zig_zag[component->quant_matrix_id], prev_DC);
+    PROFILE_BLOCK(decoder, !has_AC_coefficients(coefficients))
+
+    PROFILE_BLOCK_STAGE(decoder, STAGE_IDCT, 0)
+    transform_block(coefficients, mb_data, decoder->block_size, decoder->precision);
+
+    LOG_MATRIX_W_H(mb_data, decoder->block_size, decoder->block_size)
+    LOG_STDOUT("\n");
+}
+
+/*
+ * Decodes the H x V blocks of the component k of the MCU. It is a macro, so the decoders specialised
+ * for the common sampling factors get the loops with constant trip counts.
+ */
+#define DECODE_MCU_COMPONENT(k, H, V) { \
+    const frame_component *component = &decoder->components[k]; \
+    int *MCU_blocks = !in_window || (k) >= decoder->output_components_number ? NULL : \
+                      decoder->pipelined ? get_MCU_coefficients(decoder, component, MCU_index) \
+                                         : get_MCU_blocks(decoder, component, MCU_index); \
+    int block_stride = decoder->pipelined ? MB_SQUARE : block_square; \
+    int mb_i, mb_j; \
+    for (mb_i = 0; mb_i < (V); ++mb_i) { \
+        for (mb_j = 0; mb_j < (H); ++mb_j) { \
+            decode_MCU_block(decoder, scan_reader, component, \
+                             MCU_blocks ? MCU_blocks + ((H) * mb_i + mb_j) * block_stride : NULL, &prev_DC[k]); \
+        } \
+    } \
+}
+
+/*
+ * Decodes the MCU with any sampling factors and order of the components in the scan.
+ */
+void decode_MCU(jpeg_decoder *decoder, bitstream_reader *scan_reader, uint32_t MCU_index, int *prev_DC) {
+    int block_square = decoder->block_size * decoder->block_size;
+    int in_window = is_MCU_in_window(decoder, MCU_index);
+    int i;
+    LOG_STDOUT("\n*** Processing (%d, %d) MCU ***\n",
+               MCU_index / decoder->horizontal_MCU_number, MCU_index % decoder->horizontal_MCU_number);
+    for (i = 0; i < decoder->scan.components_number; ++i) {
+        int k = decoder->scan.component_indexes[i];
+        LOG_STDOUT("\n***** Decoding component %d scan *****\n", decoder->components[k].id);
+        DECODE_MCU_COMPONENT(k, decoder->components[k].H, decoder->components[k].V)
+    }
+}
+
+/*
+ * Decoder of the YCbCr MCU with Y_H x Y_V luma blocks and one block of each chroma component.
+ */
+#define DEFINE_DECODE_MCU(name, Y_H, Y_V) \
+void name(jpeg_decoder *decoder, bitstream_reader *scan_reader, uint32_t MCU_index, int *prev_DC) { \
+    int block_square = decoder->block_size * decoder->block_size; \
+    int in_window = is_MCU_in_window(decoder, MCU_index); \
+    DECODE_MCU_COMPONENT(0, Y_H, Y_V) \
+    DECODE_MCU_COMPONENT(1, 1, 1) \
+    DECODE_MCU_COMPONENT(2, 1, 1) \
+}
+
+DEFINE_DECODE_MCU(decode_MCU_444, 1, 1)
+DEFINE_DECODE_MCU(decode_MCU_422, 2, 1)
+DEFINE_DECODE_MCU(decode_MCU_420, 2, 2)
+
+/*
+ * Chooses the specialised MCU decoder for 4:4:4, 4:2:2 and 4:2:0 scans, the general one for the rest.
+ */
+decode_MCU_function select_decode_MCU(const jpeg_decoder *decoder) {
+    const frame_component *components = decoder->components;
+    const scan_info *scan = &decoder->scan;
+
+    if (decoder->components_number != 3 || scan->component_indexes[0] != 0 || scan->component_indexes[1] != 1 ||
+        scan->component_indexes[2] != 2 || components[1].H != 1 || components[1].V != 1 ||
+        components[2].H != 1 || components[2].V != 1) {
+        return decode_MCU;
+    }
+    if (components[0].H == 1 && components[0].V == 1) {
+        return decode_MCU_444;
+    }
+    if (components[0].H == 2 && components[0].V == 1) {
+        return decode_MCU_422;
+    }
+    if (components[0].H == 2 && components[0].V == 2) {
+        return decode_MCU_420;
+    }
+    return decode_MCU;
+}
+
+/*
+ * Decodes the whole baseline block into the coefficients of the buffered frame.
+ */
+void decode_baseline_block(jpeg_decoder *decoder, bitstream_reader *scan_reader, const frame_component *component,
+                           int16_t *block, int *prev_DC) {
+    int coefficients[MB_SQUARE] ALIGNED(32);
+    int p;
+
+    if (decoder->block_size == 1) { /* Only DC is used by the thumbnail */
+        *prev_DC += decode_macroblock_DC(scan_reader, &decoder->huffman_trees_DC[component->table_id_DC],
+                                         &decoder->huffman_trees_AC[component->table_id_AC]);
+        block[0] = (int16_t) *prev_DC;
+        return;
+    }
+
+    /* The buffered frame keeps the coefficients quantized till the last scan */
+    decode_macroblock(scan_reader, coefficients, &decoder->huffman_trees_DC[component->table_id_DC],
+                      &decoder->huffman_trees_AC[component->table_id_AC], unit_quant_matrix, prev_DC);
+    for (p = 0; p < MB_SQUARE; ++p) {
+        block[p] = (int16_t) coefficients[p];
+    }
+}
+
+void decode_buffered_block(jpeg_decoder *decoder, bitstream_reader *scan_reader, int k,
+                           uint32_t block_row, uint32_t block_col, int *prev_DC, uint32_t *EOB_run) {
+    frame_component *component = &decoder->components[k];
+    const scan_info *scan = &decoder->scan;
+    int16_t *block = component->coefficients + (block_row * component->blocks_per_line + block_col) * MB_SQUARE;
+
+    if (!decoder->progressive) {
+        decode_baseline_block(decoder, scan_reader, component, block, &prev_DC[k]);
+    } else if (scan->Ss == 0) {
+        if (scan->Ah == 0) {
+            decode_DC_first(scan_reader, &decoder->huffman_trees_DC[component->table_id_DC], block, &prev_DC[k],
+                            scan->Al);
+        } else {
+            decode_DC_refine(scan_reader, block, scan->Al);
+        }
+    } else {
+        if (scan->Ah == 0) {
+            decode_AC_first(scan_reader, &decoder->huffman_trees_AC[component->table_id_AC], block,
+                            scan->Ss, scan->Se, scan->Al, EOB_run);
+        } else {
+            decode_AC_refine(scan_reader, &decoder->huffman_trees_AC[component->table_id_AC], block,
+                             scan->Ss, scan->Se, scan->Al, EOB_run);
+        }
+    }
+}
+
+void decode_buffered_MCU(jpeg_decoder *decoder, bitstream_reader *scan_reader, uint32_t MCU_index, int *prev_DC,
+                         uint32_t *EOB_run) {
+    int i;
+    if (decoder->scan.components_number == 1) { /* Non-interleaved scan: MCU is a single block */
+        int k = decoder->scan.component_indexes[0];
+        decode_buffered_block(decoder, scan_reader, k,
+                              MCU_index / decoder->components[k].scan_blocks_per_line,
+                              MCU_index % decoder->components[k].scan_blocks_per_line,
+                              prev_DC, EOB_run);
+        return;
+    }
+    for (i = 0; i < decoder->scan.components_number; ++i) {
+        int k = decoder->scan.component_indexes[i];
+        frame_component *component = &decoder->components[k];
+        uint32_t MCU_row = MCU_index / decoder->horizontal_MCU_number;
+        uint32_t MCU_col = MCU_index % decoder->horizontal_MCU_number;
+        int mb_i, mb_j;
+        for (mb_i = 0; mb_i < component->V; ++mb_i) {
+            for (mb_j = 0; mb_j < component->H; ++mb_j) {
+                decode_buffered_block(decoder, scan_reader, k,
+                                      MCU_row * component->V + mb_i, MCU_col * component->H + mb_j,
+                                      prev_DC, EOB_run);
+            }
+        }
+    }
+}
+
+/*
+ * Thread pool task: decodes one restart interval, every interval writes only its own MCUs.
+ */
+void decode_scan_segment(void *arg) {
+    scan_segment *segment = (scan_segment *) arg;
+    jpeg_decoder *decoder = segment->decoder;
+    bitstream_reader scan_reader;
+    int prev_DC[MAX_COMPONENTS_NUMBER] = {0}; /* DC predictors are reset at the interval start */
+    uint32_t EOB_run = 0;
+    uint32_t i;
+
+    PROFILE_STAGE(decoder, STAGE_ENTROPY_DECODE)
+    init_bitstream_reader(&scan_reader, segment->data, segment->size << 3);
+    for (i = 0; i < segment->MCU_number; ++i) {
+        if (decoder->buffered) {
+            decode_buffered_MCU(decoder, &scan_reader, segment->first_MCU + i, prev_DC, &EOB_run);
+        } else {
+            decoder->decode_MCU(decoder, &scan_reader, segment->first_MCU + i, prev_DC);
+        }
+    }
+    PROFILE_FLUSH(decoder)
+}
+
+/*
+ * Entropy-decodes the scan, restart intervals are decoded in parallel.
+ */
+int decode_scan_segments(jpeg_decoder *decoder, uint32_t MCU_number) {
+    scan_segment *segments;
+    uint32_t segments_number;
+    uint32_t s;
+
+    if (split_scan_data(decoder, &segments, &segments_number, MCU_number) < 0) {
+        return -1;
+    }
+    LOG_STDOUT("Scan data consists of %d restart intervals.\n", segments_number);
+    for (s = 0; s < segments_number; ++s) {
+        run_task(decoder, decode_scan_segment, &segments[s]);
+    }
+    wait_tasks(decoder);
+
+    for (s = 0; s < segments_number; ++s) {
+        free(segments[s].data);
+    }
+    free(segments);
+    return 0;
+}
+
+/*
+ * Stores the level-shifted samples of the block at (x, y) of the plane.
+ */
+void store_block(const int *mb_data, int block_size, const frame_component *component, uint32_t x, uint32_t y) {
+    int p, l;
+    for (p = 0; p < block_size; ++p) {
+        const int *src = mb_data + block_size * p;
+        uint8_t *dst = get_plane_row(component, y + p) + x;
+        for (l = 0; l < block_size; ++l) {
+            dst[l] = CLIP(0, src[l] + 128, 255);
+        }
+    }
+}
+
+/*
+ * Stores only the top left width x height samples of the block which crosses the plane border.
+ */
+void store_block_clipped(const int *mb_data, int block_size, const frame_component *component, uint32_t x, uint32_t y,
+                         int width, int height) {
+    int p, l;
+    for (p = 0; p < height; ++p) {
+        const int *src = mb_data + block_size * p;
+        uint8_t *dst = get_plane_row(component, y + p) + x;
+        for (l = 0; l < width; ++l) {
+            dst[l] = CLIP(0, src[l] + 128, 255);
+        }
+    }
+}
+
+/*
+ * Stores the top left width x height samples of the 12-bit block, level-shifted by 2048.
+ */
+void store_block_16(const int *mb_data, int block_size, const frame_component *component, uint32_t x, uint32_t y,
+                    int width, int height, int max_value) {
+    int center = (max_value + 1) / 2;
+    int p, l;
+    for (p = 0; p < height; ++p) {
+        const int *src = mb_data + block_size * p;
+        uint16_t *dst = get_plane_row_16(component, y + p) + x;
+        for (l = 0; l < width; ++l) {
+            dst[l] = (uint16_t) CLIP(0, src[l] + center, max_value);
+        }
+    }
+}
+
+/*
+ * Thread pool task: stores one row of the decoded macroblocks into the component planes.
+ */
+void store_MCU_row(void *arg) {
+    jpeg_decoder *decoder = ((MCU_row_task *) arg)->decoder;
+    uint32_t MCU_row = ((MCU_row_task *) arg)->MCU_row;
+    int block_square = decoder->block_size * decoder->block_size;
+    uint32_t MCU_col;
+    int k;
+
+    PROFILE_STAGE(decoder, STAGE_IDCT)
+    for (k = 0; k < decoder->output_components_number; ++k) {
+        frame_component *component = &decoder->components[k];
+        for (MCU_col = decoder->window_MCU_x; MCU_col < decoder->window_MCU_x + decoder->window_MCU_width; ++MCU_col) {
+            int *MCU_blocks = get_MCU_blocks(decoder, component, MCU_row * decoder->horizontal_MCU_number + MCU_col);
+            int mb_i, mb_j;
+
+            for (mb_i = 0; mb_i < component->V; ++mb_i) {
+                for (mb_j = 0; mb_j < component->H; ++mb_j) {
+                    int *mb_data = MCU_blocks + (component->H * mb_i + mb_j) * block_square;
+                    /* Position in the plane of the window */
+                    uint32_t mb_w = ((MCU_col - decoder->window_MCU_x) * component->H + mb_j) * decoder->block_size;
+                    uint32_t mb_h = ((MCU_row - decoder->window_MCU_y) * component->V + mb_i) * decoder->block_size;
+
+                    if (decoder->precision != 8) {
+                        if (mb_w < component->plane_width && mb_h < component->plane_height) {
+                            store_block_16(mb_data, decoder->block_size, component, mb_w, mb_h,
+                                           MIN(decoder->block_size, component->plane_width - mb_w),
+                                           MIN(decoder->block_size, component->plane_height - mb_h),
+                                           (1 << decoder->precision) - 1);
+                        }
+                    } else if (mb_w + decoder->block_size <= component->plane_width &&
+                               mb_h + decoder->block_size <= component->plane_height) {
+                        store_block(mb_data, decoder->block_size, component, mb_w, mb_h);
+                    } else if (mb_w < component->plane_width && mb_h < component->plane_height) {
+                        store_block_clipped(mb_data, decoder->block_size, component, mb_w, mb_h,
+                                            MIN(decoder->block_size, component->plane_width - mb_w),
+                                            MIN(decoder->block_size, component->plane_height - mb_h));
+                    }
+                }
+            }
+        }
+    }
+    PROFILE_FLUSH(decoder)
+}
+
+/*
+ * Window lines of the row of MCUs which belong to the region.
+ */
+void get_region_lines(const jpeg_decoder *decoder, uint32_t MCU_row, uint32_t *first_line, uint32_t *last_line) {
+    uint32_t MCU_lines = decoder->V_max * decoder->block_size;
+    *first_line = MAX((MCU_row - decoder->window_MCU_y) * MCU_lines, decoder->crop_y);
+    *last_line = MIN((MCU_row - decoder->window_MCU_y + 1) * MCU_lines, decoder->crop_y + decoder->output_height);
+}
+
+#define CONVERT_SLOT_ALIGNMENT 32 /* of every buffer of the slot, for the vector kernels */
+
+size_t align_convert_size(size_t size) {
+    return (size + CONVERT_SLOT_ALIGNMENT - 1) & ~(size_t) (CONVERT_SLOT_ALIGNMENT - 1);
+}
+
+size_t get_convert_scratch_size(const jpeg_decoder *decoder, int k) {
+    const upscale_tables *tables = &decoder->components[k].upscale;
+    return align_convert_size(decoder->precision == 8 ? get_upscale_scratch_size(tables) :
+                              get_upscale_scratch_size_16(tables));
+}
+
+/*
+ * Reserves a slot of the conversion buffers for every thread which can run convert_MCU_row() at once,
+ * so the tasks do not allocate. A slot starts with its busy flag, then go the line and the upscale scratch
+ * of every component.
+ */
+int reserve_convert_slots(jpeg_decoder *decoder) {
+    size_t line_size = align_convert_size((size_t) decoder->window_width * decoder->sample_size);
+    uint32_t i;
+    int k;
+
+    decoder->convert_slots_number = decoder->pool ? decoder->pool->threads_number + 1 : 1; /* the waiting thread too */
+    decoder->convert_slot_size = CONVERT_SLOT_ALIGNMENT;
+    for (k = 0; k < decoder->output_components_number; ++k) {
+        decoder->convert_slot_size += line_size + get_convert_scratch_size(decoder, k);
+    }
+    decoder->convert_slots = (uint8_t *) reserve_buffer(&decoder->convert_buffer,
+                                                        decoder->convert_slots_number * decoder->convert_slot_size);
+    if (!decoder->convert_slots) {
+        return -1;
+    }
+    for (i = 0; i < decoder->convert_slots_number; ++i) {
+        decoder->convert_slots[i * decoder->convert_slot_size] = 0;
+    }
+    return 0;
+}
+
+/*
+ * Takes a free slot and splits it into the buffers of the components. There are as many slots
+ * as the threads, so the search only passes the slots of the other running tasks.
+ */
+uint8_t *claim_convert_slot(jpeg_decoder *decoder, void **line_buffers, void **scratch) {
+    size_t line_size = align_convert_size((size_t) decoder->window_width * decoder->sample_size);
+    uint8_t *slot = decoder->convert_slots;
+    uint8_t *buffer;
+    uint32_t i = 0;
+    int k;
+
+    while (__atomic_test_and_set(slot, __ATOMIC_ACQUIRE)) {
+        i = (i + 1) % decoder->convert_slots_number;
+        slot = decoder->convert_slots + i * decoder->convert_slot_size;
+    }
+    buffer = slot + CONVERT_SLOT_ALIGNMENT;
+    for (k = 0; k < decoder->output_components_number; ++k) {
+        line_buffers[k] = buffer;
+        scratch[k] = buffer + line_size;
+        buffer += line_size + get_convert_scratch_size(decoder, k);
+    }
+    return slot;
+}
+
+void release_convert_slot(uint8_t *slot) {
+    __atomic_clear(slot, __ATOMIC_RELEASE);
+}
+
+/*
+ * convert_MCU_row() of the 12-bit frame: the 16-bit samples go through the scalar upsampling and conversion.
+ */
+void convert_MCU_row_16(jpeg_decoder *decoder, uint32_t MCU_row) {
+    uint16_t max_value = (uint16_t) ((1 << decoder->precision) - 1);
+    uint32_t first_line, last_line;
+    const uint16_t *lines[MAX_COMPONENTS_NUMBER];
+    void *line_buffers[MAX_COMPONENTS_NUMBER];
+    void *scratch[MAX_COMPONENTS_NUMBER];
+    uint8_t *slot;
+    uint32_t y;
+    int k;
+
+    get_region_lines(decoder, MCU_row, &first_line, &last_line);
+    slot = claim_convert_slot(decoder, line_buffers, scratch);
+
+    for (y = first_line; y < last_line; ++y) {
+        PROFILE_STAGE(decoder, STAGE_UPSAMPLE)
+        for (k = 0; k < decoder->output_components_number; ++k) {
+            frame_component *component = &decoder->components[k];
+            if (component->plane_width == decoder->window_width && component->plane_height == decoder->window_height) {
+                lines[k] = get_plane_row_16(component, y) + decoder->crop_x;
+            } else {
+                upscale_row_16(&component->upscale, (const uint16_t *) component->plane, y, (int32_t *) scratch[k],
+                               (uint16_t *) line_buffers[k], max_value);
+                lines[k] = (const uint16_t *) line_buffers[k] + decoder->crop_x;
+            }
+        }
+        PROFILE_STAGE(decoder, STAGE_COLOR_CONVERT)
+        if (decoder->output_components_number == 3) {
+            YCbCr_to_RGB_row_16(lines[0], lines[1], lines[2], (uint16_t *) get_output_row(decoder, y),
+                                decoder->output_width, max_value);
+        } else {
+            memcpy(get_output_row(decoder, y), lines[0], decoder->output_width * sizeof(uint16_t));
+        }
+    }
+
+    release_convert_slot(slot);
+}
+
+/*
+ * Thread pool task: upsamples the chroma of one row of MCUs and converts it right into the output pixels.
+ * Only a line of every upsampled component exists at a time.
+ */
+void convert_MCU_row(void *arg) {
+    jpeg_decoder *decoder = ((MCU_row_task *) arg)->decoder;
+    uint32_t MCU_row = ((MCU_row_task *) arg)->MCU_row;
+    uint32_t first_line, last_line;
+    const uint8_t *lines[MAX_COMPONENTS_NUMBER];
+    void *line_buffers[MAX_COMPONENTS_NUMBER];
+    void *scratch[MAX_COMPONENTS_NUMBER];
+    uint8_t *slot;
+    uint32_t y;
+    int k;
+
+    if (decoder->precision != 8) {
+        convert_MCU_row_16(decoder, MCU_row);
+        PROFILE_FLUSH(decoder)
+        return;
+    }
+
+    get_region_lines(decoder, MCU_row, &first_line, &last_line);
+    slot = claim_convert_slot(decoder, line_buffers, scratch);
+
+    for (y = first_line; y < last_line; ++y) {
+        PROFILE_STAGE(decoder, STAGE_UPSAMPLE)
+        for (k = 0; k < decoder->output_components_number; ++k) {
+            frame_component *component = &decoder->components[k];
+            if (component->plane_width == decoder->window_width && component->plane_height == decoder->window_height) {
+                lines[k] = get_plane_row(component, y) + decoder->crop_x;
+            } else {
+                upscale_row(&component->upscale, component->plane, y, (int16_t *) scratch[k],
+                            (uint8_t *) line_buffers[k]);
+                lines[k] = (const uint8_t *) line_buffers[k] + decoder->crop_x;
+            }
+        }
+        PROFILE_STAGE(decoder, STAGE_COLOR_CONVERT)
+        if (decoder->output_components_number == 3) {
+            YCbCr_to_RGB_row(lines[0], lines[1], lines[2], get_output_row(decoder, y), decoder->output_width);
+        } else {
+            memcpy(get_output_row(decoder, y), lines[0], decoder->output_width);
+        }
+    }
+
+    release_convert_slot(slot);
+    PROFILE_FLUSH(decoder)
+}
+
+/*
+ * Runs the task for every row of MCUs and waits for all of them.
+ */
+int run_MCU_row_tasks(jpeg_decoder *decoder, thread_pool_function function) {
+    MCU_row_task *tasks = (MCU_row_task *) malloc(decoder->window_MCU_height * sizeof(MCU_row_task));
+    uint32_t i;
+
+    if (!tasks) {
+        PROCESS_ERROR("Couldn't allocate memory for the tasks of the rows of MCUs.\n");
+    }
+    for (i = 0; i < decoder->window_MCU_height; ++i) {
+        tasks[i].decoder = decoder;
+        tasks[i].MCU_row = decoder->window_MCU_y + i;
+        run_task(decoder, function, &tasks[i]);
+    }
+    wait_tasks(decoder);
+    free(tasks);
+    return 0;
+
+    fail:
+    return -1;
+}
+
+/*
+ * Also reserves the conversion buffers. The upscale tables are destroyed on failure.
+ */
+int init_planes(jpeg_decoder *decoder) {
+    int k;
+
+    for (k = 0; k < decoder->output_components_number; ++k) {
+        frame_component *component = &decoder->components[k];
+        component->plane_width = decoder->window_MCU_width * component->H * decoder->block_size;
+        component->plane_height = decoder->window_MCU_height * component->V * decoder->block_size;
+        if (decoder->streaming) {
+            component->plane_rows_stored = decoder->streamed_MCU_rows * component->V * decoder->block_size;
+        } else {
+            component->plane_rows_stored = component->plane_height;
+        }
+        if (decoder->plane_is_output) { /* Blocks beyond the output size are clipped by the store */
+            component->plane_width = decoder->output_width;
+            component->plane_height = decoder->output_height;
+            component->plane = decoder->output_data;
+        } else {
+            component->plane = (uint8_t *) reserve_buffer(&decoder->plane_buffers[k],
+                    (size_t) component->plane_width * component->plane_rows_stored * decoder->sample_size);
+            if (!component->plane) {
+                PROCESS_ERROR("Couldn't allocate memory for the plane of the component %d.\n", component->id);
+            }
+        }
+        if (init_upscale_tables(&component->upscale, component->plane_width, component->plane_height,
+                                decoder->window_width, decoder->window_height) < 0) {
+            destroy_upscale_tables(&component->upscale);
+            PROCESS_ERROR("Couldn't allocate memory for the upscale tables of the component %d.\n", component->id);
+        }
+        component->upscale.in_rows_stored = component->plane_rows_stored;
+    }
+    if (!decoder->plane_is_output && reserve_convert_slots(decoder) < 0) {
+        PROCESS_ERROR("Couldn't allocate memory for the conversion buffers.\n");
+    }
+    return 0;
+
+    fail:
+    while (k-- > 0) {
+        destroy_upscale_tables(&decoder->components[k].upscale);
+    }
+    return -1;
+}
+
+void destroy_planes(jpeg_decoder *decoder) {
+    int k;
+
+    for (k = 0; k < decoder->output_components_number; ++k) {
+        frame_component *component = &decoder->components[k];
+        destroy_upscale_tables(&component->upscale);
+    }
+}
+
+/*
+ * Stores the decoded macroblocks into the component planes, upscales them and converts into the output pixels.
+ */
+int output_frame(jpeg_decoder *decoder) {
+    int ret;
+    int k;
+
+    if (init_planes(decoder) < 0) {
+        return -1;
+    }
+
+    ret = run_MCU_row_tasks(decoder, store_MCU_row);
+
+    for (k = 0; k < decoder->output_components_number; ++k) {
+        frame_component *component = &decoder->components[k];
+        LOG_STDOUT("Full data for %d-th component.\n", component->id);
+        LOG_MATRIX_W_H(component->plane, component->plane_width, component->plane_height)
+        LOG_STDOUT("\n");
+    }
+
+    if (ret >= 0 && !decoder->plane_is_output) {
+        /* Upsampling needs the neighbour MCU rows, so conversion starts when all the rows are stored */
+        ret = run_MCU_row_tasks(decoder, convert_MCU_row);
+    }
+
+    destroy_planes(decoder);
+
+    if (ret < 0) {
+        return ret;
+    }
+    if (decoder->row_callback) {
+        PROFILE_STAGE(decoder, STAGE_OUTPUT_WRITE)
+        return decoder->row_callback(decoder->row_callback_arg, decoder->output_data, 0, decoder->output_height);
+    }
+    return 0;
+}
+
+/*
+ * Converts the stored row of MCUs and hands its output rows to the row callback.
+ */
+int output_MCU_row(jpeg_decoder *decoder, uint32_t MCU_row) {
+    uint32_t first_line, last_line;
+    MCU_row_task task;
+
+    get_region_lines(decoder, MCU_row, &first_line, &last_line);
+    if (first_line >= last_line) { /* Only a neighbour of the region */
+        return 0;
+    }
+    task.decoder = decoder;
+    task.MCU_row = MCU_row;
+    if (!decoder->plane_is_output) {
+        convert_MCU_row(&task);
+    }
+    PROFILE_STAGE(decoder, STAGE_OUTPUT_WRITE)
+    return decoder->row_callback(decoder->row_callback_arg, get_output_row(decoder, first_line),
+                                 first_line - decoder->crop_y, last_line - first_line);
+}
+
+/*
+ * Decodes the baseline scan one row of MCUs at a time. The planes keep only STREAMED_MCU_ROWS rows of MCUs:
+ * a row is converted when the next one is stored, because upsampling reads the neighbour rows.
+ */
+int stream_scan_data(jpeg_decoder *decoder) {
+    scan_segment *segments;
+    uint32_t segments_number;
+    MCU_row_task task;
+    uint32_t s;
+    int ret = 0;
+
+    if (split_scan_data(decoder, &segments, &segments_number,
+                        decoder->horizontal_MCU_number * decoder->vertical_MCU_number) < 0) {
+        return -1;
+    }
+    task.decoder = decoder;
+    for (s = 0; s < segments_number && ret >= 0; ++s) {
+        bitstream_reader scan_reader;
+        int prev_DC[MAX_COMPONENTS_NUMBER] = {0}; /* DC predictors are reset at the interval start */
+        uint32_t last_MCU = segments[s].first_MCU + segments[s].MCU_number;
+        uint32_t MCU_index;
+
+        init_bitstream_reader(&scan_reader, segments[s].data, segments[s].size << 3);
+        for (MCU_index = segments[s].first_MCU; MCU_index < last_MCU && ret >= 0; ++MCU_index) {
+            decoder->decode_MCU(decoder, &scan_reader, MCU_index, prev_DC);
+            /* The row of the window is complete with its last MCU */
+            if (is_MCU_in_window(decoder, MCU_index) && MCU_index % decoder->horizontal_MCU_number ==
+                    (uint32_t) (decoder->window_MCU_x + decoder->window_MCU_width - 1)) {
+                task.MCU_row = MCU_index / decoder->horizontal_MCU_number;
+                store_MCU_row(&task);
+                if (task.MCU_row > decoder->window_MCU_y) {
+                    ret = output_MCU_row(decoder, task.MCU_row - 1);
+                }
+            }
+        }
+    }
+    if (ret >= 0) {
+        ret = output_MCU_row(decoder, decoder->window_MCU_y + decoder->window_MCU_height - 1);
+    }
+
+    for (s = 0; s < segments_number; ++s) {
+        free(segments[s].data);
+    }
+    free(segments);
+    return ret;
+}
+
+/*
+ * Rows of MCUs between the entropy decode and the transform. The counters are window MCU rows:
+ * the entropy-decoding thread publishes the rows in order, the pool threads take them in order
+ * and release every slot when its row is not needed anymore.
+ */
+typedef struct decode_pipeline {
+    jpeg_decoder *decoder;
+    uint32_t decoded_rows; /* written only by the entropy-decoding thread */
+    uint32_t next_row; /* the next row to transform */
+    uint32_t *released_rows; /* of every slot: the row which was in it plus one */
+    int stopped; /* by the row callback error */
+    pthread_mutex_t output_mutex; /* streaming only: the rows are converted and output in order */
+    uint32_t *stored_rows; /* of every slot: the row stored into the planes plus one */
+    uint32_t output_rows;
+    int ret;
+    pthread_mutex_t wait_mutex; /* the threads waiting for a row or a slot block on the conditions */
+    pthread_cond_t row_decoded;
+    pthread_cond_t slot_released;
+} decode_pipeline;
+
+/*
+ * Transforms the dequantized coefficients of the pipelined row of MCUs into the decoded macroblocks.
+ */
+void transform_MCU_row(void *arg) {
+    jpeg_decoder *decoder = ((MCU_row_task *) arg)->decoder;
+    uint32_t MCU_row = ((MCU_row_task *) arg)->MCU_row;
+    int block_square = decoder->block_size * decoder->block_size;
+    uint32_t MCU_col;
+    int k, b;
+
+    PROFILE_STAGE(decoder, STAGE_IDCT)
+    for (k = 0; k < decoder->output_components_number; ++k) {
+        frame_component *component = &decoder->components[k];
+        for (MCU_col = decoder->window_MCU_x; MCU_col < decoder->window_MCU_x + decoder->window_MCU_width; ++MCU_col) {
+            uint32_t MCU_index = MCU_row * decoder->horizontal_MCU_number + MCU_col;
+            const int *coefficients = get_MCU_coefficients(decoder, component, MCU_index);
+            int *MCU_blocks = get_MCU_blocks(decoder, component, MCU_index);
+
+            for (b = 0; b < component->H * component->V; ++b) {
+                transform_block(coefficients + b * MB_SQUARE, MCU_blocks + b * block_square, decoder->block_size,
+                                decoder->precision);
+            }
+        }
+    }
+}
+
+/*
+ * Publishes the change of a pipeline counter to the threads blocked in wait_pipeline_counter().
+ */
+void notify_pipeline(decode_pipeline *pipeline, pthread_cond_t *condition) {
+    pthread_mutex_lock(&pipeline->wait_mutex);
+    pthread_cond_broadcast(condition);
+    pthread_mutex_unlock(&pipeline->wait_mutex);
+}
+
+void release_pipeline_slot(decode_pipeline *pipeline, uint32_t row) {
+    __atomic_store_n(&pipeline->released_rows[row % pipeline->decoder->pipeline_slots], row + 1, __ATOMIC_RELEASE);
+    if (__atomic_load_n(&pipeline->stopped, __ATOMIC_ACQUIRE)) { /* The waiting threads have to see it too */
+        notify_pipeline(pipeline, &pipeline->row_decoded);
+    }
+    notify_pipeline(pipeline, &pipeline->slot_released);
+}
+
+/*
+ * Waits till the counter reaches the value or the decoding is stopped, returns 0 in the latter case.
+ * A short spin catches the counter which is about to change, then the thread blocks.
+ */
+int wait_pipeline_counter(decode_pipeline *pipeline, const uint32_t *counter, uint32_t value,
+                          pthread_cond_t *condition) {
+    int i;
+
+    for (i = 0; i < PIPELINE_SPIN_COUNT; ++i) {
+        if (__atomic_load_n(counter, __ATOMIC_ACQUIRE) >= value) {
+            return 1;
+        }
+        if (__atomic_load_n(&pipeline->stopped, __ATOMIC_ACQUIRE)) {
+            return 0;
+        }
+    }
+    pthread_mutex_lock(&pipeline->wait_mutex);
+    while (__atomic_load_n(counter, __ATOMIC_ACQUIRE) < value &&
+           !__atomic_load_n(&pipeline->stopped, __ATOMIC_ACQUIRE)) {
+        pthread_cond_wait(condition, &pipeline->wait_mutex);
+    }
+    pthread_mutex_unlock(&pipeline->wait_mutex);
+    return __atomic_load_n(counter, __ATOMIC_ACQUIRE) >= value;
+}
+
+/*
+ * Marks the window row as stored and outputs the rows which have their lower neighbour stored too,
+ * in order. The slot of the output row is given back to the entropy decode.
+ */
+void output_pipeline_rows(decode_pipeline *pipeline, uint32_t row) {
+    jpeg_decoder *decoder = pipeline->decoder;
+    uint32_t slots = decoder->pipeline_slots;
+
+    pthread_mutex_lock(&pipeline->output_mutex);
+    pipeline->stored_rows[row % slots] = row + 1;
+    while (pipeline->output_rows < decoder->window_MCU_height && pipeline->ret >= 0) {
+        uint32_t next = pipeline->output_rows;
+        if (pipeline->stored_rows[next % slots] != next + 1 ||
+            (next + 1 < decoder->window_MCU_height && pipeline->stored_rows[(next + 1) % slots] != next + 2)) {
+            break;
+        }
+        pipeline->ret = output_MCU_row(decoder, decoder->window_MCU_y + next);
+        if (pipeline->ret < 0) {
+            __atomic_store_n(&pipeline->stopped, 1, __ATOMIC_RELEASE);
+        }
+        release_pipeline_slot(pipeline, next);
+        ++pipeline->output_rows;
+    }
+    pthread_mutex_unlock(&pipeline->output_mutex);
+}
+
+/*
+ * Transforms the decoded window row. The streamed row is also stored into the planes and output.
+ */
+void process_pipeline_row(decode_pipeline *pipeline, uint32_t row) {
+    jpeg_decoder *decoder = pipeline->decoder;
+    MCU_row_task task;
+
+    task.decoder = decoder;
+    task.MCU_row = decoder->window_MCU_y + row;
+    transform_MCU_row(&task);
+    if (decoder->streaming) {
+        store_MCU_row(&task);
+        output_pipeline_rows(pipeline, row);
+    } else { /* All the macroblocks of the frame are kept till output_frame() */
+        release_pipeline_slot(pipeline, row);
+    }
+}
+
+/*
+ * Thread pool task: transforms the decoded rows of MCUs until there are no more of them.
+ */
+void pipeline_worker(void *arg) {
+    decode_pipeline *pipeline = (decode_pipeline *) arg;
+    jpeg_decoder *decoder = pipeline->decoder;
+    uint32_t row;
+
+    while ((row = __atomic_fetch_add(&pipeline->next_row, 1, __ATOMIC_RELAXED)) < decoder->window_MCU_height) {
+        if (__atomic_load_n(&pipeline->decoded_rows, __ATOMIC_ACQUIRE) <= row) {
+            PROFILE_STAGE(decoder, STAGE_IDLE)
+            if (!wait_pipeline_counter(pipeline, &pipeline->decoded_rows, row + 1, &pipeline->row_decoded)) {
+                break;
+            }
+        }
+        process_pipeline_row(pipeline, row);
+    }
+    PROFILE_FLUSH(decoder)
+}
+
+/*
+ * Waits till the slot of the window row is released by the row which was in it before,
+ * returns 0 if the decoding is stopped. Meanwhile the entropy-decoding thread transforms the decoded rows
+ * which no worker has taken yet: the workers may be busy with other tasks of the pool or not started at all.
+ */
+int wait_pipeline_slot(decode_pipeline *pipeline, uint32_t row) {
+    jpeg_decoder *decoder = pipeline->decoder;
+    uint32_t slots = decoder->pipeline_slots;
+    uint32_t next_row;
+
+    if (row < slots ||
+        __atomic_load_n(&pipeline->released_rows[row % slots], __ATOMIC_ACQUIRE) == row - slots + 1) {
+        return 1;
+    }
+    while (__atomic_load_n(&pipeline->released_rows[row % slots], __ATOMIC_ACQUIRE) != row - slots + 1) {
+        if (__atomic_load_n(&pipeline->stopped, __ATOMIC_ACQUIRE)) {
+            return 0;
+        }
+        next_row = __atomic_load_n(&pipeline->next_row, __ATOMIC_RELAXED);
+        if (next_row < row && __atomic_compare_exchange_n(&pipeline->next_row, &next_row, next_row + 1, 0,
+                                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            process_pipeline_row(pipeline, next_row);
+            PROFILE_STAGE(decoder, STAGE_ENTROPY_DECODE)
+        } else if (next_row >= row) { /* All the decoded rows are taken, their workers release the slot */
+            PROFILE_STAGE(decoder, STAGE_IDLE)
+            return wait_pipeline_counter(pipeline, &pipeline->released_rows[row % slots], row - slots + 1,
+                                         &pipeline->slot_released);
+        }
+    }
+    return 1;
+}
+
+/*
+ * Decodes the baseline scan in two stages: the calling thread only entropy-decodes the rows of MCUs into a ring
+ * of pipeline_slots rows of coefficients, and the pool threads transform them. The wall time is close to
+ * the entropy decode alone when there are enough threads, even without restart intervals. The streamed rows
+ * are converted by the pool threads as well, one after another in order.
+ */
+int pipeline_scan_data(jpeg_decoder *decoder) {
+    decode_pipeline pipeline;
+    scan_segment *segments = NULL;
+    uint32_t segments_number = 0;
+    uint32_t s;
+    int i, k;
+    int ret;
+
+    memset(&pipeline, 0, sizeof(decode_pipeline));
+    pipeline.decoder = decoder;
+    pipeline.released_rows = (uint32_t *) calloc(decoder->pipeline_slots, sizeof(uint32_t));
+    pipeline.stored_rows = (uint32_t *) calloc(decoder->pipeline_slots, sizeof(uint32_t));
+    pthread_mutex_init(&pipeline.output_mutex, NULL);
+    pthread_mutex_init(&pipeline.wait_mutex, NULL);
+    pthread_cond_init(&pipeline.row_decoded, NULL);
+    pthread_cond_init(&pipeline.slot_released, NULL);
+    if (!pipeline.released_rows || !pipeline.stored_rows) {
+        PROCESS_ERROR("Couldn't allocate memory for the pipeline slots.\n");
+    }
+    for (k = 0; k < decoder->output_components_number; ++k) {
+        frame_component *component = &decoder->components[k];
+        /* decode_macroblock() needs the aligned blocks */
+        component->pipeline_coefficients = (int *) reserve_buffer(&decoder->pipeline_buffers[k],
+                (size_t) decoder->pipeline_slots * decoder->window_MCU_width * component->H * component->V *
+                MB_SQUARE * sizeof(int));
+        if (!component->pipeline_coefficients) {
+            PROCESS_ERROR("Couldn't allocate memory for the pipeline of the component %d.\n", component->id);
+        }
+    }
+
+    if (split_scan_data(decoder, &segments, &segments_number,
+                        decoder->horizontal_MCU_number * decoder->vertical_MCU_number) < 0) {
+        goto fail;
+    }
+    for (i = 0; i < decoder->pool->threads_number; ++i) {
+        run_task(decoder, pipeline_worker, &pipeline);
+    }
+
+    PROFILE_STAGE(decoder, STAGE_ENTROPY_DECODE)
+    for (s = 0; s < segments_number && !__atomic_load_n(&pipeline.stopped, __ATOMIC_ACQUIRE); ++s) {
+        bitstream_reader scan_reader;
+        int prev_DC[MAX_COMPONENTS_NUMBER] = {0}; /* DC predictors are reset at the interval start */
+        uint32_t last_MCU = segments[s].first_MCU + segments[s].MCU_number;
+        uint32_t MCU_index;
+
+        init_bitstream_reader(&scan_reader, segments[s].data, segments[s].size << 3);
+        for (MCU_index = segments[s].first_MCU; MCU_index < last_MCU; ++MCU_index) {
+            uint32_t MCU_col = MCU_index % decoder->horizontal_MCU_number;
+            uint32_t row = MCU_index / decoder->horizontal_MCU_number - decoder->window_MCU_y;
+            int in_window = is_MCU_in_window(decoder, MCU_index);
+
+            if (in_window && MCU_col == decoder->window_MCU_x && !wait_pipeline_slot(&pipeline, row)) {
+                break;
+            }
+            decoder->decode_MCU(decoder, &scan_reader, MCU_index, prev_DC);
+            if (in_window && MCU_col == (uint32_t) (decoder->window_MCU_x + decoder->window_MCU_width - 1)) {
+                __atomic_store_n(&pipeline.decoded_rows, row + 1, __ATOMIC_RELEASE);
+                notify_pipeline(&pipeline, &pipeline.row_decoded);
+            }
+        }
+    }
+    wait_tasks(decoder);
+    ret = pipeline.ret;
+    goto end;
+
+    fail:
+    ret = -1;
+
+    end:
+    for (k = 0; k < decoder->output_components_number; ++k) {
+        decoder->components[k].pipeline_coefficients = NULL;
+    }
+    for (s = 0; s < segments_number; ++s) {
+        free(segments[s].data);
+    }
+    free(segments);
+    pthread_mutex_destroy(&pipeline.output_mutex);
+    pthread_cond_destroy(&pipeline.slot_released);
+    pthread_cond_destroy(&pipeline.row_decoded);
+    pthread_mutex_destroy(&pipeline.wait_mutex);
+    free(pipeline.released_rows);
+    free(pipeline.stored_rows);
+    return ret;
+}
+
+int decode_scan_data(jpeg_decoder *decoder) {
+    int ret;
+
+    LOG_STDOUT("Started decoding scan data.\n");
+    init_IDCT_tables();
+    if (allocate_mb_input_data(decoder) < 0) {
+        return -1;
+    }
+
+    if (decoder->streaming) {
+        if (init_planes(decoder) < 0) {
+            return -1;
+        }
+        ret = decoder->pipelined ? pipeline_scan_data(decoder) : stream_scan_data(decoder);
+        destroy_planes(decoder);
+        return ret;
+    }
+
+    // Decode interleaved data
+    if (decoder->pipelined) {
+        if (pipeline_scan_data(decoder) < 0) {
+            return -1;
+        }
+    } else if (decode_scan_segments(decoder, decoder->horizontal_MCU_number * decoder->vertical_MCU_number) < 0) {
+        return -1;
+    }
+
+    return output_frame(decoder);
+}
+
+/*
+ * Moves the reader past the entropy-coded data of the scan and its restart markers.
+ */
+void skip_scan_data(jpeg_decoder *decoder) {
+    while (1) {
+        uint32_t marker_position = find_next_marker_position(&decoder->reader);
+        skip_bits(&decoder->reader, marker_position - get_current_position(&decoder->reader));
+        if (marker_position + 16 > decoder->reader.bits_size ||
+            (show_bits_16bit(&decoder->reader, 16) & RSTn_MASK) != RST0) {
+            break;
+        }
+        skip_bits(&decoder->reader, 16);
+    }
+}
+
+int decode_buffered_scan_data(jpeg_decoder *decoder) {
+    uint32_t MCU_number;
+
+    LOG_STDOUT("Started decoding buffered scan data: Ss = %d, Se = %d, Ah = %d, Al = %d.\n",
+               decoder->scan.Ss, decoder->scan.Se, decoder->scan.Ah, decoder->scan.Al);
+
+    if (decoder->scan.components_number == 1) {
+        frame_component *component = &decoder->components[decoder->scan.component_indexes[0]];
+        MCU_number = component->scan_blocks_per_line * component->scan_block_rows;
+    } else {
+        MCU_number = decoder->horizontal_MCU_number * decoder->vertical_MCU_number;
+    }
+    return decode_scan_segments(decoder, MCU_number);
+}
+
+/*
+ * Thread pool task: dequantizes and transforms one row of MCUs of the buffered frame.
+ */
+void transform_coefficients_row(void *arg) {
+    jpeg_decoder *decoder = ((MCU_row_task *) arg)->decoder;
+    uint32_t MCU_row = ((MCU_row_task *) arg)->MCU_row;
+    uint32_t MCU_col;
+    int block_square = decoder->block_size * decoder->block_size;
+    int coefficients[MB_SQUARE] ALIGNED(32);
+    int k;
+
+    for (MCU_col = decoder->window_MCU_x; MCU_col < decoder->window_MCU_x + decoder->window_MCU_width; ++MCU_col) {
+        uint32_t MCU_index = MCU_row * decoder->horizontal_MCU_number + MCU_col;
+        for (k = 0; k < decoder->output_components_number; ++k) {
+            frame_component *component = &decoder->components[k];
+            const uint16_t *quant_matrix = decoder->quant_matrices[component->quant_matrix_id];
+            int *MCU_blocks = get_MCU_blocks(decoder, component, MCU_index);
+            int mb_i, mb_j;
+            for (mb_i = 0; mb_i < component->V; ++mb_i) {
+                for (mb_j = 0; mb_j < component->H; ++mb_j) {
+                    uint32_t block_row = MCU_row * component->V + mb_i;
+                    uint32_t block_col = MCU_col * component->H + mb_j;
+                    const int16_t *block =
+                            component->coefficients + (block_row * component->blocks_per_line + block_col) * MB_SQUARE;
+                    int *mb_data = MCU_blocks + (component->H * mb_i + mb_j) * block_square;
+                    int p;
+                    if (decoder->block_size == 1) {
+                        mb_data[0] = get_DC_sample(block[0], quant_matrix);
+                        PROFILE_DC_ONLY_BLOCK(decoder)
+                        continue;
+                    }
+                    PROFILE_BLOCK_STAGE(decoder, STAGE_DEQUANTIZATION, 1)
+                    for (p = 0; p < MB_SQUARE; ++p) {
+                        coefficients[p] = block[p];
+                    }
+                    dequantization(coefficients, quant_matrix);
+                    PROFILE_BLOCK(decoder, !has_AC_coefficients(coefficients))
+                    PROFILE_BLOCK_STAGE(decoder, STAGE_IDCT, 0)
+                    transform_block(coefficients, mb_data, decoder->block_size, decoder->precision);
+                }
+            }
+        }
+    }
+    PROFILE_FLUSH(decoder)
+}
+
+/*
+ * Runs IDCT once for the whole buffered frame after the last scan, or gives the coefficients
+ * to the coefficients callback.
+ */
+int finish_buffered_frame(jpeg_decoder *decoder) {
+    int k;
+
+    if (decoder->coefficients_callback) {
+        int ret = decoder->coefficients_callback(decoder->coefficients_callback_arg, decoder);
+        for (k = 0; k < decoder->components_number; ++k) {
+            decoder->components[k].coefficients = NULL;
+        }
+        return ret;
+    }
+
+    LOG_STDOUT("Transforming the buffered frame coefficients.\n");
+    init_IDCT_tables();
+    if (allocate_mb_input_data(decoder) < 0) {
+        return -1;
+    }
+
+    if (run_MCU_row_tasks(decoder, transform_coefficients_row) < 0) {
+        return -1;
+    }
+
+    for (k = 0; k < decoder->components_number; ++k) {
+        decoder->components[k].coefficients = NULL;
+    }
+
+    return output_frame(decoder);
+}
+
+int scan_has_output_components(const jpeg_decoder *decoder) {
+    int i;
+    for (i = 0; i < decoder->scan.components_number; ++i) {
+        if (decoder->scan.component_indexes[i] < decoder->output_components_number) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int parse_SOS(jpeg_decoder *decoder) {
+    uint16_t length;
+    uint8_t scan_components;
+    uint8_t Ss, Se, Ah, Al;
+
+    int i;
+
+    length = read_bits_16bit(&decoder->reader, 16);
+    LOG_STDOUT("Length = %d.\n", length);
+    (void) length; /* only logged */
+
+    scan_components = read_bits_8bit(&decoder->reader, 8);
+    assert(scan_components >= 1 && scan_components <= decoder->components_number);
+    decoder->scan.components_number = scan_components;
+
+    for (i = 0; i < scan_components; ++i) {
+        uint8_t component_selector = read_bits_8bit(&decoder->reader, 8);
+        uint8_t table_id_DC = read_bits_8bit(&decoder->reader, 4);
+        uint8_t table_id_AC = read_bits_8bit(&decoder->reader, 4);
+        int k;
+        for (k = 0; k < decoder->components_number && decoder->components[k].id != component_selector; ++k);
+        assert(k < decoder->components_number);
+        assert(table_id_DC < HUFFMAN_TABLES_NUMBER);
+        assert(table_id_AC < HUFFMAN_TABLES_NUMBER);
+        decoder->components[k].table_id_AC = table_id_AC;
+        decoder->components[k].table_id_DC = table_id_DC;
+        decoder->scan.component_indexes[i] = k;
+        LOG_STDOUT("Processed %d-th component: selector = %d, DC_table_id = %d, AC_table_id = %d.\n",
+                   i + 1, component_selector, table_id_DC, table_id_AC);
+    }
+
+    Ss = read_bits_8bit(&decoder->reader, 8);
+    Se = read_bits_8bit(&decoder->reader, 8);
+    Ah = read_bits_8bit(&decoder->reader, 4);
+    Al = read_bits_8bit(&decoder->reader, 4);
+    decoder->scan.Ss = Ss;
+    decoder->scan.Se = Se;
+    decoder->scan.Ah = Ah;
+    decoder->scan.Al = Al;
+
+    if (decoder->scans_number++ == 0 && start_frame(decoder) < 0) {
+        return -1;
+    }
+
+    if (decoder->progressive) {
+        assert(Ss <= Se && Se <= 63);
+        assert((Ss == 0) == (Se == 0)); /* DC and AC coefficients are never mixed in one scan */
+        assert(Ss == 0 || scan_components == 1); /* AC scans are always non-interleaved */
+    } else {
+        assert(Ss == 0 && Se == 63 && Ah == 0 && Al == 0);
+    }
+    if (decoder->progressive && Ss != 0 && decoder->block_size == 1) {
+        LOG_STDOUT("AC scan is skipped, the thumbnail needs only DC.\n");
+        skip_scan_data(decoder);
+        return 0;
+    }
+    if (!scan_has_output_components(decoder)) {
+        LOG_STDOUT("Chroma scan is skipped, only the luma is output.\n");
+        skip_scan_data(decoder);
+        return 0;
+    }
+    if (decoder->buffered) {
+        return decode_buffered_scan_data(decoder);
+    }
+    decoder->decode_MCU = select_decode_MCU(decoder);
+    return decode_scan_data(decoder);
+}
+
+int parse_segment(jpeg_decoder *decoder) {
+    uint16_t marker;
+    int ret = 0;
+
+    PROFILE_STAGE(decoder, STAGE_MARKERS)
+    marker = read_bits_16bit(&decoder->reader, 16);
+    LOG_STDOUT("%X: ", marker);
+
+    if (marker == SOI) {
+        LOG_STDOUT("Start Of Image (SOI) was read.\n");
+    } else if (marker == COM) {
+        uint16_t length = read_bits_16bit(&decoder->reader, 16);
+        skip_bits(&decoder->reader, (length - 2) << 3);
+        LOG_STDOUT("Comment (COM) was read and %d bytes were skipped.\n", length - 2);
+    } else if (marker == DQT) {
+        LOG_STDOUT("Define Quantization Tables (DQT) was read.\n");
+        parse_DQT(decoder);
+    } else if (marker == SOF0 || marker == SOF1 || marker == SOF2) {
+        decoder->progressive = marker == SOF2;
+        LOG_STDOUT("Start Of Frame, %s DCT (SOF%d) was read.\n", decoder->progressive ? "progressive" : "sequential",
+                   marker & 0x0F);
+        if (parse_SOF(decoder) < 0) {
+            goto fail;
+        }
+    } else if (marker == DHT) {
+        LOG_STDOUT("Define Huffman Tables (DHT) was read.\n");
+        parse_DHT(decoder);
+    } else if (marker == DRI) {
+        LOG_STDOUT("Define Restart Interval (DRI) was read.\n");
+        parse_DRI(decoder);
+    } else if (marker == SOS) {
+        LOG_STDOUT("Start Of Scan (SOS) was read.\n");
+        if (parse_SOS(decoder) < 0) {
+            goto fail;
+        }
+    } else if (marker == EOI) {
+        LOG_STDOUT("End Of Image (EOI) was read.\n");
+        if (decoder->buffered && finish_buffered_frame(decoder) < 0) {
+            goto fail;
+        }
+        ret = 1;
+    } else if ((marker & APPn_MASK) == APPn_MASK) {
+        uint16_t length = read_bits_16bit(&decoder->reader, 16);
+        skip_bits(&decoder->reader, (length - 2) << 3);
+        LOG_STDOUT("Application-specific (App%X) was read and %d bytes were skipped.\n",
+                   marker & ~APPn_MASK, length - 2);
+    } else {
+        PROCESS_ERROR("Unsupported marker.\n");
+    }
+    LOG_STDOUT("\n");
+
+    goto end;
+
+    fail:
+    ret = -1;
+
+    end:
+    return ret;
+}
+
+/*
+ * Decodes the image from the memory buffer into decoder->output_data, which stays valid
+ * until destroy_jpeg_decoder() or the next decode with the same context. With the row callback set
+ * the rows are handed to it in order instead, and baseline images never have the whole frame in memory.
+ */
+int decode_JPEG(jpeg_decoder *decoder, const uint8_t *data, size_t data_size) {
+    int i;
+    int ret = 0;
+
+    if (data_size > MAX_INPUT_SIZE) {
+        fprintf(stderr, "The JPEG data is too large, it must be less than 512 MB.\n");
+        return -1;
+    }
+#if PROFILING_ENABLE
+    if (decoder->profiling) {
+        start_profile(&decoder->profile, decoder->pool ? MAX(decoder->pool->threads_number, 1) : 1);
+    }
+#endif
+    init_bitstream_reader(&decoder->reader, data, (uint32_t) (data_size << 3));
+    decoder->output_data = NULL; /* its buffer is reused */
+    decoder->components = NULL;
+    decoder->restart_interval = 0;
+    decoder->progressive = 0;
+    decoder->buffered = 0;
+
+    decoder->huffman_trees_AC = (Huffman_node *) malloc(HUFFMAN_TABLES_NUMBER * sizeof(Huffman_node));
+    decoder->huffman_trees_DC = (Huffman_node *) malloc(HUFFMAN_TABLES_NUMBER * sizeof(Huffman_node));
+    for (i = 0; i < HUFFMAN_TABLES_NUMBER; ++i) {
+        init_huffman_node(&decoder->huffman_trees_AC[i], 0);
+        init_huffman_node(&decoder->huffman_trees_DC[i], 0);
+    }
+
+    while (!ret) {
+        ret = parse_segment(decoder);
+    }
+
+    for (i = 0; i < HUFFMAN_TABLES_NUMBER; ++i) {
+        clear_huffman_tree(&decoder->huffman_trees_AC[i]);
+        clear_huffman_tree(&decoder->huffman_trees_DC[i]);
+    }
+    free(decoder->huffman_trees_AC);
+    free(decoder->huffman_trees_DC);
+
+    free(decoder->components);
+    decoder->components = NULL;
+
+#if PROFILING_ENABLE
+    PROFILE_FLUSH(decoder)
+    if (decoder->profiling) {
+        stop_profile(&decoder->profile);
+    }
+#endif
+    return ret < 0 ? -1 : 0;
+}
+
+/*
+ * Decodes only the width x height rectangle of the output pixels at (x, y). The whole scan still has to be
+ * entropy-decoded up to the region end, but only the MCUs around the region are transformed and converted,
+ * and the restart intervals which don't touch them are skipped.
+ */
+int decode_region(jpeg_decoder *decoder, const uint8_t *data, size_t data_size,
+                  uint32_t x, uint32_t y, uint32_t width, uint32_t height) {
+    int ret;
+
+    decoder->region_x = x;
+    decoder->region_y = y;
+    decoder->region_width = width;
+    decoder->region_height = height;
+    ret = decode_JPEG(decoder, data, data_size);
+    decoder->region_width = decoder->region_height = 0;
+    return ret;
+}
+
+#endif
@@ -0,0 +1,667 @@
+/*
+ * Baseline JPEG encoder of grayscale and RGB images. The image is cut into bands of MCU rows which are
+ * separate restart intervals, so the bands are transformed and entropy-coded in parallel and only
+ * concatenated with the restart markers at the end.
+ */
+
+#ifndef LAB8_JPEG_ENCODER_H
+#define LAB8_JPEG_ENCODER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include "common.h"
+#include "jpeg_tables.h"
+#include "bitstream_writer.h"
+#include "huffman_encoder.h"
+#include "forward_dct.h"
+#include "thread_pool.h"
+
+#define ENCODER_MAX_COMPONENTS 3
+#define DEFAULT_QUALITY 75
+#define BANDS_PER_THREAD 4 /* more bands than threads even out the bands of different complexity */
+#define MAX_BLOCK_BYTES 512 /* 64 codes of at most 27 bits with every byte stuffed */
+
+/* RGB -> YCbCr coefficients multiplied by 2^16 */
+#define ENCODER_SCALE_BITS 16
+#define R_TO_Y 19595   /* 0.299 */
+#define G_TO_Y 38470   /* 0.587 */
+#define B_TO_Y 7471    /* 0.114 */
+#define R_TO_CB 11059  /* 0.16874 */
+#define G_TO_CB 21709  /* 0.33126 */
+#define B_TO_CR 5329   /* 0.08131 */
+#define G_TO_CR 27439  /* 0.41869 */
+#define HALF_TO_C 32768 /* 0.5 */
+
+typedef struct encoder_component {
+    uint8_t id;
+    uint8_t H; // horizontal factor
+    uint8_t V; // vertical factor
+    uint8_t table_id; /* quantization matrix and Huffman tables: 0 for luma, 1 for chroma */
+    uint32_t plane_width; /* samples of the component in the whole MCUs */
+} encoder_component;
+
+/*
+ * Rows of MCUs encoded independently as one restart interval.
+ */
+typedef struct encoder_band {
+    struct jpeg_encoder *encoder;
+    uint32_t first_MCU_row;
+    uint32_t MCU_rows;
+    int16_t *coefficients; /* quantized coefficients of the blocks in the order of the scan, in the zig-zag order */
+    uint32_t DC_frequencies[2][HUFFMAN_SYMBOLS_NUMBER];
+    uint32_t AC_frequencies[2][HUFFMAN_SYMBOLS_NUMBER];
+    bitstream_writer writer;
+} encoder_band;
+
+typedef struct jpeg_encoder {
+    /* Options, set by the caller after init_jpeg_encoder() */
+    int quality; /* 1..100 scales the standard quantization matrices */
+    uint8_t chroma_subsampling; /* 1 keeps the full chroma (4:4:4), 2 halves it in both directions (4:2:0) */
+    int optimize_Huffman; /* build the optimal Huffman tables for the image instead of the standard ones */
+    uint32_t band_MCU_rows; /* 0 chooses the bands by the number of threads */
+    thread_pool *pool; /* NULL runs everything on the calling thread */
+
+    const uint8_t *pixels; /* interleaved grayscale or RGB samples */
+    uint16_t width;
+    uint16_t height;
+    uint8_t components_number;
+
+    encoder_component components[ENCODER_MAX_COMPONENTS];
+    uint8_t H_max;
+    uint8_t V_max;
+    uint32_t horizontal_MCU_number;
+    uint32_t vertical_MCU_number;
+    uint32_t blocks_per_MCU;
+    uint16_t restart_interval;
+
+    uint8_t quant_matrices[2][MB_SQUARE]; /* in the natural order */
+    uint32_t divisors[2][MB_SQUARE]; /* the coefficients are 8 times larger than the quantization matrix expects */
+    uint32_t reciprocals[2][MB_SQUARE]; /* 2^32 / divisor rounded up, so the division is a multiplication */
+    Huffman_table Huffman_tables_DC[2];
+    Huffman_table Huffman_tables_AC[2];
+
+    encoder_band *bands;
+    uint32_t bands_number;
+    thread_pool_group tasks; /* of this encoder in the pool */
+
+    bitstream_writer output; /* the JPEG file */
+} jpeg_encoder;
+
+void init_jpeg_encoder(jpeg_encoder *encoder) {
+    memset(encoder, 0, sizeof(jpeg_encoder));
+    encoder->quality = DEFAULT_QUALITY;
+    encoder->chroma_subsampling = 2;
+    init_bitstream_writer(&encoder->output);
+}
+
+void destroy_jpeg_encoder(jpeg_encoder *encoder) {
+    destroy_bitstream_writer(&encoder->output);
+}
+
+void run_encoder_task(jpeg_encoder *encoder, thread_pool_function function, void *arg) {
+    if (encoder->pool) {
+        submit_task(encoder->pool, &encoder->tasks, function, arg);
+    } else {
+        function(arg);
+    }
+}
+
+void wait_encoder_tasks(jpeg_encoder *encoder) {
+    if (encoder->pool) {
+        wait_thread_pool(encoder->pool, &encoder->tasks);
+    }
+}
+
+/*
+ * Scales the standard matrices like the IJG software does: the quality 50 gives them as they are.
+ */
+void init_quant_matrices(jpeg_encoder *encoder) {
+    int quality = CLIP(1, encoder->quality, 100);
+    int scale = quality < 50 ? 5000 / quality : 200 - quality * 2;
+    int i, k;
+
+    for (i = 0; i < 2; ++i) {
+        const uint8_t *standard_matrix = i == 0 ? standard_luminance_quant_matrix : standard_chrominance_quant_matrix;
+        for (k = 0; k < MB_SQUARE; ++k) {
+            int value = (standard_matrix[k] * scale + 50) / 100;
+            encoder->quant_matrices[i][k] = (uint8_t) CLIP(1, value, 255);
+            encoder->divisors[i][k] = (uint32_t) (encoder->quant_matrices[i][k] * 8);
+            encoder->reciprocals[i][k] = (uint32_t) ((((uint64_t) 1) << 32) / encoder->divisors[i][k] + 1);
+        }
+    }
+}
+
+void init_standard_Huffman_tables(jpeg_encoder *encoder) {
+    build_Huffman_codes(&encoder->Huffman_tables_DC[0], standard_DC_luminance_lengths, standard_DC_luminance_values);
+    build_Huffman_codes(&encoder->Huffman_tables_AC[0], standard_AC_luminance_lengths, standard_AC_luminance_values);
+    build_Huffman_codes(&encoder->Huffman_tables_DC[1], standard_DC_chrominance_lengths,
+                        standard_DC_chrominance_values);
+    build_Huffman_codes(&encoder->Huffman_tables_AC[1], standard_AC_chrominance_lengths,
+                        standard_AC_chrominance_values);
+}
+
+/*
+ * Fills the component planes with the samples of one MCU row, the right and bottom edges of the image
+ * are repeated into the padding. Chroma is averaged over the H_max / H x V_max / V pixels.
+ */
+void load_MCU_row(const jpeg_encoder *encoder, uint32_t MCU_row, uint8_t **planes) {
+    uint32_t rows = encoder->V_max * MB_H;
+    uint32_t width = encoder->components[0].plane_width;
+    uint32_t copied = MIN(width, encoder->width);
+    uint32_t x, y;
+    int k;
+
+    for (y = 0; y < rows; ++y) {
+        uint32_t image_row = MIN(MCU_row * rows + y, (uint32_t) encoder->height - 1);
+        const uint8_t *src = encoder->pixels + (size_t) image_row * encoder->width * encoder->components_number;
+        uint8_t *Y_row = planes[0] + (size_t) y * width;
+        uint8_t *Cb_row, *Cr_row;
+
+        if (encoder->components_number == 1) {
+            memcpy(Y_row, src, copied);
+            memset(Y_row + copied, Y_row[copied - 1], width - copied);
+            continue;
+        }
+
+        Cb_row = planes[1] + (size_t) y * width;
+        Cr_row = planes[2] + (size_t) y * width;
+        for (x = 0; x < copied; ++x) {
+            int R = src[3 * x], G = src[3 * x + 1], B = src[3 * x + 2];
+            Y_row[x] = (uint8_t) ((R_TO_Y * R + G_TO_Y * G + B_TO_Y * B + (1 << (ENCODER_SCALE_BITS - 1)))
+                    >> ENCODER_SCALE_BITS);
+            Cb_row[x] = (uint8_t) ((-R_TO_CB * R - G_TO_CB * G + HALF_TO_C * B + (128 << ENCODER_SCALE_BITS) +
+                                    (1 << (ENCODER_SCALE_BITS - 1)) - 1) >> ENCODER_SCALE_BITS);
+            Cr_row[x] = (uint8_t) ((HALF_TO_C * R - G_TO_CR * G - B_TO_CR * B + (128 << ENCODER_SCALE_BITS) +
+                                    (1 << (ENCODER_SCALE_BITS - 1)) - 1) >> ENCODER_SCALE_BITS);
+        }
+        memset(Y_row + copied, Y_row[copied - 1], width - copied);
+        memset(Cb_row + copied, Cb_row[copied - 1], width - copied);
+        memset(Cr_row + copied, Cr_row[copied - 1], width - copied);
+    }
+
+    /* Chroma is downsampled in place, the plane rows become plane_width long */
+    for (k = 1; k < encoder->components_number; ++k) {
+        const encoder_component *component = &encoder->components[k];
+        int factor_x = encoder->H_max / component->H;
+        int factor_y = encoder->V_max / component->V;
+        int area = factor_x * factor_y;
+        if (area == 1) {
+            continue;
+        }
+        for (y = 0; y < rows / factor_y; ++y) {
+            uint8_t *dst = planes[k] + (size_t) y * component->plane_width;
+            for (x = 0; x < component->plane_width; ++x) {
+                int sum = 0;
+                int i, j;
+                for (i = 0; i < factor_y; ++i) {
+                    const uint8_t *src = planes[k] + (size_t) (y * factor_y + i) * width + x * factor_x;
+                    for (j = 0; j < factor_x; ++j) {
+                        sum += src[j];
+                    }
+                }
+                dst[x] = (uint8_t) ((sum + area / 2) / area);
+            }
+        }
+    }
+}
+
+/*
+ * Rounds the magnitudes to the nearest multiples of the divisors: (|c| + d / 2) / d with the reciprocals.
+ * The result is stored in the zig-zag order.
+ */
+void quantize_block(const int32_t *coefficients, const uint32_t *divisors, const uint32_t *reciprocals,
+                    int16_t *block) {
+    int32_t quotients[MB_SQUARE] ALIGNED(32);
+    int k;
+
+#ifdef __AVX2__
+    for (k = 0; k < MB_SQUARE; k += 8) {
+        __m256i coefficient = _mm256_load_si256((const __m256i *) (coefficients + k));
+        __m256i divisor = _mm256_loadu_si256((const __m256i *) (divisors + k));
+        __m256i reciprocal = _mm256_loadu_si256((const __m256i *) (reciprocals + k));
+        __m256i magnitude = _mm256_add_epi32(_mm256_abs_epi32(coefficient), _mm256_srli_epi32(divisor, 1));
+        /* High halves of the 32x32-bit products: even lanes are shifted down, odd lanes are in place */
+        __m256i even = _mm256_srli_epi64(_mm256_mul_epu32(magnitude, reciprocal), 32);
+        __m256i odd = _mm256_mul_epu32(_mm256_srli_epi64(magnitude, 32), _mm256_srli_epi64(reciprocal, 32));
+        __m256i quotient = _mm256_blend_epi32(even, odd, 0xAA);
+        _mm256_store_si256((__m256i *) (quotients + k), _mm256_sign_epi32(quotient, coefficient));
+    }
+#else
+    for (k = 0; k < MB_SQUARE; ++k) {
+        int32_t coefficient = coefficients[k];
+        uint32_t magnitude = (uint32_t) (coefficient < 0 ? -coefficient : coefficient) + (divisors[k] >> 1);
+        int32_t quotient = (int32_t) (((uint64_t) magnitude * reciprocals[k]) >> 32);
+        quotients[k] = coefficient < 0 ? -quotient : quotient;
+    }
+#endif
+    for (k = 0; k < MB_SQUARE; ++k) {
+        block[k] = (int16_t) quotients[reverse_zig_zag[k]];
+    }
+}
+
+/*
+ * Bit k is set if the k-th coefficient of the block in the zig-zag order is not zero.
+ */
+uint64_t get_nonzero_mask(const int16_t *block) {
+#ifdef __AVX2__
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i zero_0_31 = _mm256_packs_epi16(_mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i *) block), zero),
+                                           _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i *) (block + 16)), zero));
+    __m256i zero_32_63 = _mm256_packs_epi16(_mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i *) (block + 32)), zero),
+                                            _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i *) (block + 48)), zero));
+    /* packs interleaves the 128-bit lanes of its arguments */
+    uint32_t low = (uint32_t) _mm256_movemask_epi8(_mm256_permute4x64_epi64(zero_0_31, 0xD8));
+    uint32_t high = (uint32_t) _mm256_movemask_epi8(_mm256_permute4x64_epi64(zero_32_63, 0xD8));
+    return ~(((uint64_t) high << 32) | low);
+#else
+    uint64_t mask = 0;
+    int k;
+    for (k = 0; k < MB_SQUARE; ++k) {
+        if (block[k] != 0) {
+            mask |= (uint64_t) 1 << k;
+        }
+    }
+    return mask;
+#endif
+}
+
+/*
+ * Counts the Huffman symbols of the block for the optimal tables.
+ */
+void count_block_symbols(const int16_t *block, int *prev_DC, uint32_t *DC_frequencies, uint32_t *AC_frequencies) {
+    uint64_t mask = get_nonzero_mask(block) & ~(uint64_t) 1;
+    int last = 0;
+
+    ++DC_frequencies[get_value_length(block[0] - *prev_DC)];
+    *prev_DC = block[0];
+    while (mask) {
+        int k = __builtin_ctzll(mask);
+        int run = k - last - 1;
+        for (; run > 15; run -= 16) {
+            ++AC_frequencies[0xF0]; /* ZRL */
+        }
+        ++AC_frequencies[(run << 4) | get_value_length(block[k])];
+        last = k;
+        mask &= mask - 1;
+    }
+    if (last != MB_SQUARE - 1) {
+        ++AC_frequencies[0x00]; /* EOB */
+    }
+}
+
+void encode_block(bitstream_writer *writer, const int16_t *block, int *prev_DC,
+                  const Huffman_table *table_DC, const Huffman_table *table_AC) {
+    uint64_t mask = get_nonzero_mask(block) & ~(uint64_t) 1;
+    int DC_difference = block[0] - *prev_DC;
+    int length = get_value_length(DC_difference);
+    int last = 0;
+
+    if (!reserve_bytes(writer, MAX_BLOCK_BYTES)) {
+        return;
+    }
+    write_Huffman_value(writer, table_DC, (uint8_t) length, DC_difference, length);
+    *prev_DC = block[0];
+    while (mask) {
+        int k = __builtin_ctzll(mask);
+        int run = k - last - 1;
+        for (; run > 15; run -= 16) {
+            write_Huffman_value(writer, table_AC, 0xF0, 0, 0); /* ZRL */
+        }
+        length = get_value_length(block[k]);
+        write_Huffman_value(writer, table_AC, (uint8_t) ((run << 4) | length), block[k], length);
+        last = k;
+        mask &= mask - 1;
+    }
+    if (last != MB_SQUARE - 1) {
+        write_Huffman_value(writer, table_AC, 0x00, 0, 0); /* EOB */
+    }
+}
+
+/*
+ * Thread pool task: converts the band row by row, transforms and quantizes its blocks and counts their symbols.
+ */
+void transform_band(void *arg) {
+    encoder_band *band = (encoder_band *) arg;
+    jpeg_encoder *encoder = band->encoder;
+    uint32_t plane_size = encoder->V_max * MB_H * encoder->components[0].plane_width;
+    uint8_t *planes[ENCODER_MAX_COMPONENTS];
+    int32_t coefficients[MB_SQUARE] ALIGNED(32);
+    int prev_DC[ENCODER_MAX_COMPONENTS] = {0}; /* DC predictors are reset at the interval start */
+    int16_t *block = band->coefficients;
+    uint32_t MCU_row, MCU_col;
+    int k;
+
+    /* One MCU row of the planes stays in the cache between the conversion and the transform */
+    for (k = 0; k < encoder->components_number; ++k) {
+        planes[k] = (uint8_t *) malloc(plane_size * sizeof(uint8_t));
+    }
+
+    for (MCU_row = 0; MCU_row < band->MCU_rows; ++MCU_row) {
+        load_MCU_row(encoder, band->first_MCU_row + MCU_row, planes);
+        for (MCU_col = 0; MCU_col < encoder->horizontal_MCU_number; ++MCU_col) {
+            for (k = 0; k < encoder->components_number; ++k) {
+                const encoder_component *component = &encoder->components[k];
+                int mb_i, mb_j;
+                for (mb_i = 0; mb_i < component->V; ++mb_i) {
+                    for (mb_j = 0; mb_j < component->H; ++mb_j) {
+                        const uint8_t *samples = planes[k] + (size_t) mb_i * MB_H * component->plane_width +
+                                                 (MCU_col * component->H + mb_j) * MB_W;
+                        forward_DCT(samples, component->plane_width, coefficients);
+                        quantize_block(coefficients, encoder->divisors[component->table_id],
+                                       encoder->reciprocals[component->table_id], block);
+                        count_block_symbols(block, &prev_DC[k], band->DC_frequencies[component->table_id],
+                                            band->AC_frequencies[component->table_id]);
+                        block += MB_SQUARE;
+                    }
+                }
+            }
+        }
+    }
+
+    for (k = 0; k < encoder->components_number; ++k) {
+        free(planes[k]);
+    }
+}
+
+/*
+ * Thread pool task: entropy-codes the quantized blocks of the band into its own buffer.
+ */
+void encode_band(void *arg) {
+    encoder_band *band = (encoder_band *) arg;
+    jpeg_encoder *encoder = band->encoder;
+    int prev_DC[ENCODER_MAX_COMPONENTS] = {0};
+    const int16_t *block = band->coefficients;
+    uint32_t MCU_index;
+    int k;
+
+    for (MCU_index = 0; MCU_index < band->MCU_rows * encoder->horizontal_MCU_number; ++MCU_index) {
+        for (k = 0; k < encoder->components_number; ++k) {
+            const encoder_component *component = &encoder->components[k];
+            int blocks_number = component->H * component->V;
+            int i;
+            for (i = 0; i < blocks_number; ++i) {
+                encode_block(&band->writer, block, &prev_DC[k], &encoder->Huffman_tables_DC[component->table_id],
+                             &encoder->Huffman_tables_AC[component->table_id]);
+                block += MB_SQUARE;
+            }
+        }
+    }
+    flush_bits(&band->writer);
+}
+
+/*
+ * Builds the optimal tables for the symbols counted in all the bands.
+ */
+void init_optimal_Huffman_tables(jpeg_encoder *encoder) {
+    uint32_t frequencies[HUFFMAN_SYMBOLS_NUMBER];
+    int tables_number = encoder->components_number == 1 ? 1 : 2;
+    int table_id, i;
+    uint32_t b;
+
+    for (table_id = 0; table_id < tables_number; ++table_id) {
+        memset(frequencies, 0, sizeof(frequencies));
+        for (b = 0; b < encoder->bands_number; ++b) {
+            for (i = 0; i < HUFFMAN_SYMBOLS_NUMBER; ++i) {
+                frequencies[i] += encoder->bands[b].DC_frequencies[table_id][i];
+            }
+        }
+        build_optimal_Huffman_table(&encoder->Huffman_tables_DC[table_id], frequencies);
+
+        memset(frequencies, 0, sizeof(frequencies));
+        for (b = 0; b < encoder->bands_number; ++b) {
+            for (i = 0; i < HUFFMAN_SYMBOLS_NUMBER; ++i) {
+                frequencies[i] += encoder->bands[b].AC_frequencies[table_id][i];
+            }
+        }
+        build_optimal_Huffman_table(&encoder->Huffman_tables_AC[table_id], frequencies);
+    }
+}
+
+void write_Huffman_table(bitstream_writer *writer, const Huffman_table *table, uint8_t table_class, uint8_t table_id) {
+    put_byte(writer, (uint8_t) ((table_class << 4) | table_id));
+    put_bytes(writer, table->length_to_codes_number, MAX_CODE_LENGTH);
+    put_bytes(writer, table->codes_values, get_codes_number(table));
+}
+
+/*
+ * Writes all the segments before the entropy-coded data.
+ */
+void write_headers(jpeg_encoder *encoder) {
+    bitstream_writer *output = &encoder->output;
+    int tables_number = encoder->components_number == 1 ? 1 : 2;
+    uint16_t length;
+    int i, k;
+
+    put_16bit(output, 0xFFD8); /* SOI */
+
+    put_16bit(output, 0xFFE0); /* APP0: JFIF 1.01 without the thumbnail */
+    put_16bit(output, 16);
+    put_bytes(output, (const uint8_t *) "JFIF", 5);
+    put_16bit(output, 0x0101);
+    put_byte(output, 0); /* no units, aspect ratio 1:1 */
+    put_16bit(output, 1);
+    put_16bit(output, 1);
+    put_byte(output, 0);
+    put_byte(output, 0);
+
+    put_16bit(output, 0xFFDB); /* DQT */
+    put_16bit(output, (uint16_t) (2 + tables_number * (1 + MB_SQUARE)));
+    for (i = 0; i < tables_number; ++i) {
+        put_byte(output, (uint8_t) i); /* 8-bit precision */
+        for (k = 0; k < MB_SQUARE; ++k) {
+            put_byte(output, encoder->quant_matrices[i][reverse_zig_zag[k]]);
+        }
+    }
+
+    put_16bit(output, 0xFFC0); /* SOF0 */
+    put_16bit(output, (uint16_t) (8 + 3 * encoder->components_number));
+    put_byte(output, 8);
+    put_16bit(output, encoder->height);
+    put_16bit(output, encoder->width);
+    put_byte(output, encoder->components_number);
+    for (k = 0; k < encoder->components_number; ++k) {
+        const encoder_component *component = &encoder->components[k];
+        put_byte(output, component->id);
+        put_byte(output, (uint8_t) ((component->H << 4) | component->V));
+        put_byte(output, component->table_id);
+    }
+
+    length = 2;
+    for (i = 0; i < tables_number; ++i) {
+        length += 2 * (1 + MAX_CODE_LENGTH) + get_codes_number(&encoder->Huffman_tables_DC[i]) +
+                  get_codes_number(&encoder->Huffman_tables_AC[i]);
+    }
+    put_16bit(output, 0xFFC4); /* DHT */
+    put_16bit(output, length);
+    for (i = 0; i < tables_number; ++i) {
+        write_Huffman_table(output, &encoder->Huffman_tables_DC[i], 0, (uint8_t) i);
+        write_Huffman_table(output, &encoder->Huffman_tables_AC[i], 1, (uint8_t) i);
+    }
+
+    if (encoder->bands_number > 1) {
+        put_16bit(output, 0xFFDD); /* DRI */
+        put_16bit(output, 4);
+        put_16bit(output, encoder->restart_interval);
+    }
+
+    put_16bit(output, 0xFFDA); /* SOS */
+    put_16bit(output, (uint16_t) (6 + 2 * encoder->components_number));
+    put_byte(output, encoder->components_number);
+    for (k = 0; k < encoder->components_number; ++k) {
+        const encoder_component *component = &encoder->components[k];
+        put_byte(output, component->id);
+        put_byte(output, (uint8_t) ((component->table_id << 4) | component->table_id));
+    }
+    put_byte(output, 0); /* Ss */
+    put_byte(output, MB_SQUARE - 1); /* Se */
+    put_byte(output, 0); /* Ah, Al */
+}
+
+void init_components(jpeg_encoder *encoder) {
+    int k;
+
+    encoder->H_max = encoder->V_max = 1;
+    if (encoder->components_number == 3) {
+        encoder->H_max = encoder->V_max = encoder->chroma_subsampling == 2 ? 2 : 1;
+    }
+    encoder->horizontal_MCU_number = (encoder->width + encoder->H_max * MB_W - 1) / (encoder->H_max * MB_W);
+    encoder->vertical_MCU_number = (encoder->height + encoder->V_max * MB_H - 1) / (encoder->V_max * MB_H);
+    encoder->blocks_per_MCU = 0;
+    for (k = 0; k < encoder->components_number; ++k) {
+        encoder_component *component = &encoder->components[k];
+        component->id = (uint8_t) (k + 1);
+        component->H = k == 0 ? encoder->H_max : 1;
+        component->V = k == 0 ? encoder->V_max : 1;
+        component->table_id = k == 0 ? 0 : 1;
+        component->plane_width = encoder->horizontal_MCU_number * component->H * MB_W;
+        encoder->blocks_per_MCU += component->H * component->V;
+    }
+}
+
+/*
+ * Cuts the MCU rows into the bands, every band is one restart interval.
+ */
+int init_bands(jpeg_encoder *encoder) {
+    uint32_t band_MCU_rows = encoder->band_MCU_rows;
+    uint32_t b;
+
+    if (band_MCU_rows == 0) {
+        uint32_t bands_number = 1;
+        if (encoder->pool && encoder->pool->threads_number > 1) {
+            bands_number = encoder->pool->threads_number * BANDS_PER_THREAD;
+        }
+        band_MCU_rows = (encoder->vertical_MCU_number + bands_number - 1) / bands_number;
+    }
+    /* The restart interval is a 16-bit number of MCUs */
+    band_MCU_rows = CLIP(1, band_MCU_rows, UINT16_MAX / encoder->horizontal_MCU_number);
+    encoder->bands_number = (encoder->vertical_MCU_number + band_MCU_rows - 1) / band_MCU_rows;
+    encoder->restart_interval = (uint16_t) (band_MCU_rows * encoder->horizontal_MCU_number);
+
+    encoder->bands = (encoder_band *) calloc(encoder->bands_number, sizeof(encoder_band));
+    if (!encoder->bands) {
+        PROCESS_ERROR("Couldn't allocate memory for %u bands.\n", encoder->bands_number);
+    }
+    for (b = 0; b < encoder->bands_number; ++b) {
+        encoder_band *band = &encoder->bands[b];
+        band->encoder = encoder;
+        band->first_MCU_row = b * band_MCU_rows;
+        band->MCU_rows = MIN(band_MCU_rows, encoder->vertical_MCU_number - band->first_MCU_row);
+        init_bitstream_writer(&band->writer);
+        band->coefficients = (int16_t *) malloc(
+                (size_t) band->MCU_rows * encoder->horizontal_MCU_number * encoder->blocks_per_MCU * MB_SQUARE *
+                sizeof(int16_t));
+        if (!band->coefficients) {
+            PROCESS_ERROR("Couldn't allocate memory for the coefficients of the band %u.\n", b);
+        }
+    }
+    return 0;
+
+    fail:
+    return -1;
+}
+
+void destroy_bands(jpeg_encoder *encoder) {
+    uint32_t b;
+
+    if (!encoder->bands) {
+        return;
+    }
+    for (b = 0; b < encoder->bands_number; ++b) {
+        free(encoder->bands[b].coefficients);
+        destroy_bitstream_writer(&encoder->bands[b].writer);
+    }
+    free(encoder->bands);
+    encoder->bands = NULL;
+}
+
+/*
+ * Entropy-codes the quantized coefficients of the bands with the standard or the optimal Huffman tables
+ * and writes the whole file into encoder->output.
+ */
+int encode_bands(jpeg_encoder *encoder) {
+    uint32_t b;
+
+    if (encoder->optimize_Huffman) {
+        init_optimal_Huffman_tables(encoder);
+    } else {
+        init_standard_Huffman_tables(encoder);
+    }
+
+    for (b = 0; b < encoder->bands_number; ++b) {
+        run_encoder_task(encoder, encode_band, &encoder->bands[b]);
+    }
+    wait_encoder_tasks(encoder);
+
+    write_headers(encoder);
+    for (b = 0; b < encoder->bands_number; ++b) {
+        bitstream_writer *band_writer = &encoder->bands[b].writer;
+        if (band_writer->failed) {
+            PROCESS_ERROR("Couldn't allocate memory for the entropy-coded data.\n");
+        }
+        if (b != 0) {
+            put_16bit(&encoder->output, (uint16_t) (0xFFD0 + (b - 1) % 8)); /* RSTn */
+        }
+        put_bytes(&encoder->output, band_writer->buffer, band_writer->size);
+    }
+    put_16bit(&encoder->output, 0xFFD9); /* EOI */
+    if (encoder->output.failed) {
+        PROCESS_ERROR("Couldn't allocate memory for the output.\n");
+    }
+
+    return 0;
+
+    fail:
+    return -1;
+}
+
+/*
+ * Encodes the width x height image of interleaved samples (1 component is grayscale, 3 are RGB)
+ * into encoder->output, which stays valid until destroy_jpeg_encoder() or the next encode.
+ */
+int encode_JPEG(jpeg_encoder *encoder, const uint8_t *pixels, uint16_t width, uint16_t height,
+                uint8_t components_number) {
+    uint32_t b;
+    int ret = 0;
+
+    assert(components_number == 1 || components_number == 3);
+    assert(width > 0 && height > 0);
+    encoder->pixels = pixels;
+    encoder->width = width;
+    encoder->height = height;
+    encoder->components_number = components_number;
+    destroy_bitstream_writer(&encoder->output);
+
+    init_components(encoder);
+    init_quant_matrices(encoder);
+    if (init_bands(encoder) < 0) {
+        goto fail;
+    }
+
+    for (b = 0; b < encoder->bands_number; ++b) {
+        run_encoder_task(encoder, transform_band, &encoder->bands[b]);
+    }
+    wait_encoder_tasks(encoder);
+
+    if (encode_bands(encoder) < 0) {
+        goto fail;
+    }
+
+    goto end;
+
+    fail:
+    ret = -1;
+
+    end:
+    destroy_bands(encoder);
+    return ret;
+}
+
+#endif
@@ -0,0 +1,304 @@
+/*
+ * Lossless rotation and flipping of JPEG files in the DCT domain. The quantized coefficients of the source
+ * are never transformed into pixels: the blocks are permuted, their coefficients are transposed and
+ * the odd frequencies are negated, and the result is entropy-coded again by the encoder.
+ *
+ * A flip moves the right or the bottom edge of the image to the left or to the top, where the padding
+ * of the partial MCU can't be, so the partial MCUs of that edge are trimmed like jpegtran -trim does.
+ */
+
+#ifndef LAB8_JPEG_TRANSFORM_H
+#define LAB8_JPEG_TRANSFORM_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "common.h"
+#include "jpeg_tables.h"
+#include "thread_pool.h"
+#include "jpeg_decoder.h"
+#include "jpeg_encoder.h"
+
+typedef enum transform_type {
+    TRANSFORM_NONE,
+    TRANSFORM_FLIP_HORIZONTAL,
+    TRANSFORM_FLIP_VERTICAL,
+    TRANSFORM_ROTATE_90, /* clockwise */
+    TRANSFORM_ROTATE_180,
+    TRANSFORM_ROTATE_270
+} transform_type;
+
+typedef struct jpeg_transformer {
+    /* Options, set by the caller after init_jpeg_transformer() */
+    transform_type transform;
+    int optimize_Huffman;
+    int verbose;
+    thread_pool *pool; /* NULL runs everything on the calling thread */
+
+    /* Every transform is the transposition followed by the flips of the transposed image */
+    uint8_t transpose;
+    uint8_t flip_x;
+    uint8_t flip_y;
+    uint8_t coefficient_sources[MB_SQUARE]; /* of the zig-zag output coefficients in the natural source block */
+    int16_t coefficient_signs[MB_SQUARE];
+    uint32_t flipped_blocks_x[ENCODER_MAX_COMPONENTS]; /* blocks of the output component mirrored by the flips */
+    uint32_t flipped_blocks_y[ENCODER_MAX_COMPONENTS];
+
+    const jpeg_decoder *decoder; /* of the source, while its coefficients are transformed */
+    jpeg_encoder encoder; /* encoder.output is the transformed file */
+} jpeg_transformer;
+
+/*
+ * Thread pool task argument: the band of the output filled with the transformed coefficients.
+ */
+typedef struct transform_band_task {
+    jpeg_transformer *transformer;
+    encoder_band *band;
+} transform_band_task;
+
+void init_jpeg_transformer(jpeg_transformer *transformer) {
+    memset(transformer, 0, sizeof(jpeg_transformer));
+    init_jpeg_encoder(&transformer->encoder);
+}
+
+void destroy_jpeg_transformer(jpeg_transformer *transformer) {
+    destroy_jpeg_encoder(&transformer->encoder);
+}
+
+/*
+ * Where every output coefficient comes from: the transposition swaps the horizontal and the vertical frequencies,
+ * the mirror of a block negates its odd frequencies along the mirrored direction.
+ */
+void init_coefficient_mapping(jpeg_transformer *transformer) {
+    int k;
+
+    switch (transformer->transform) {
+        case TRANSFORM_FLIP_HORIZONTAL:
+            transformer->flip_x = 1;
+            break;
+        case TRANSFORM_FLIP_VERTICAL:
+            transformer->flip_y = 1;
+            break;
+        case TRANSFORM_ROTATE_90:
+            transformer->transpose = transformer->flip_x = 1;
+            break;
+        case TRANSFORM_ROTATE_180:
+            transformer->flip_x = transformer->flip_y = 1;
+            break;
+        case TRANSFORM_ROTATE_270:
+            transformer->transpose = transformer->flip_y = 1;
+            break;
+        default:
+            break;
+    }
+
+    for (k = 0; k < MB_SQUARE; ++k) {
+        int u = reverse_zig_zag[k] % MB_W; /* horizontal frequency of the output */
+        int v = reverse_zig_zag[k] / MB_W;
+        transformer->coefficient_sources[k] = (uint8_t) (transformer->transpose ? u * MB_W + v : reverse_zig_zag[k]);
+        transformer->coefficient_signs[k] = (int16_t) (((transformer->flip_x && (u & 1)) ^
+                                                        (transformer->flip_y && (v & 1))) ? -1 : 1);
+    }
+}
+
+/*
+ * Sets up the output frame: the sampling factors follow the transposition, the dimensions mirrored by a flip
+ * are trimmed to the whole MCUs. Only the quantization matrices of 8-bit baseline output are supported,
+ * one for the luma and one shared by the chroma components.
+ */
+int init_transformed_frame(jpeg_transformer *transformer) {
+    const jpeg_decoder *decoder = transformer->decoder;
+    jpeg_encoder *encoder = &transformer->encoder;
+    uint32_t width = transformer->transpose ? decoder->frame_height : decoder->frame_width;
+    uint32_t height = transformer->transpose ? decoder->frame_width : decoder->frame_height;
+    uint32_t MCU_width, MCU_height;
+    int i, k;
+
+    if (decoder->precision != 8) {
+        PROCESS_ERROR("The %d-bit samples can't be transformed, the output is 8-bit baseline.\n", decoder->precision);
+    }
+    encoder->components_number = decoder->components_number;
+    encoder->H_max = transformer->transpose ? decoder->V_max : decoder->H_max;
+    encoder->V_max = transformer->transpose ? decoder->H_max : decoder->V_max;
+    MCU_width = encoder->H_max * MB_W;
+    MCU_height = encoder->V_max * MB_H;
+    if (transformer->flip_x) {
+        width -= width % MCU_width;
+    }
+    if (transformer->flip_y) {
+        height -= height % MCU_height;
+    }
+    if (width == 0 || height == 0) {
+        PROCESS_ERROR("The %dx%d image is smaller than one MCU, it can't be flipped losslessly.\n",
+                      decoder->frame_width, decoder->frame_height);
+    }
+    if (transformer->verbose && (width != (transformer->transpose ? decoder->frame_height : decoder->frame_width) ||
+                                 height != (transformer->transpose ? decoder->frame_width : decoder->frame_height))) {
+        fprintf(stderr, "The partial MCUs are trimmed, the output is %ux%u.\n", width, height);
+    }
+    encoder->width = (uint16_t) width;
+    encoder->height = (uint16_t) height;
+    encoder->horizontal_MCU_number = width / MCU_width + (width % MCU_width != 0);
+    encoder->vertical_MCU_number = height / MCU_height + (height % MCU_height != 0);
+
+    encoder->blocks_per_MCU = 0;
+    for (k = 0; k < encoder->components_number; ++k) {
+        const frame_component *source = &decoder->components[k];
+        encoder_component *component = &encoder->components[k];
+        component->id = source->id;
+        component->H = transformer->transpose ? source->V : source->H;
+        component->V = transformer->transpose ? source->H : source->V;
+        component->table_id = k == 0 ? 0 : 1;
+        encoder->blocks_per_MCU += component->H * component->V;
+        transformer->flipped_blocks_x[k] = width / MCU_width * component->H;
+        transformer->flipped_blocks_y[k] = height / MCU_height * component->V;
+    }
+
+    for (k = 0; k < encoder->components_number; ++k) {
+        const uint16_t *quant_matrix = decoder->quant_matrices[decoder->components[k].quant_matrix_id];
+        uint8_t *output_matrix = encoder->quant_matrices[encoder->components[k].table_id];
+        if (k == 2) {
+            if (memcmp(quant_matrix, decoder->quant_matrices[decoder->components[1].quant_matrix_id],
+                       MB_SQUARE * sizeof(uint16_t))) {
+                PROCESS_ERROR("The chroma components have different quantization matrices, it isn't supported.\n");
+            }
+            continue;
+        }
+        for (i = 0; i < MB_SQUARE; ++i) {
+            uint16_t value = quant_matrix[transformer->transpose ? (i % MB_W) * MB_W + i / MB_W : i];
+            if (value > UINT8_MAX) {
+                PROCESS_ERROR("The quantization matrix has 16-bit entries, they aren't supported by the baseline output.\n");
+            }
+            output_matrix[i] = (uint8_t) value;
+        }
+    }
+    return 0;
+
+    fail:
+    return -1;
+}
+
+/*
+ * Thread pool task: fills the band with the transformed blocks of the source in the order of the output scan
+ * and counts their symbols for the optimal Huffman tables.
+ */
+void transform_coefficients_band(void *arg) {
+    jpeg_transformer *transformer = ((transform_band_task *) arg)->transformer;
+    encoder_band *band = ((transform_band_task *) arg)->band;
+    const jpeg_decoder *decoder = transformer->decoder;
+    const jpeg_encoder *encoder = &transformer->encoder;
+    int prev_DC[ENCODER_MAX_COMPONENTS] = {0}; /* DC predictors are reset at the interval start */
+    int16_t *block = band->coefficients;
+    uint32_t MCU_row, MCU_col;
+    int k, p;
+
+    for (MCU_row = band->first_MCU_row; MCU_row < band->first_MCU_row + band->MCU_rows; ++MCU_row) {
+        for (MCU_col = 0; MCU_col < encoder->horizontal_MCU_number; ++MCU_col) {
+            for (k = 0; k < encoder->components_number; ++k) {
+                const encoder_component *component = &encoder->components[k];
+                const frame_component *source = &decoder->components[k];
+                int mb_i, mb_j;
+                for (mb_i = 0; mb_i < component->V; ++mb_i) {
+                    for (mb_j = 0; mb_j < component->H; ++mb_j) {
+                        uint32_t x = MCU_col * component->H + mb_j;
+                        uint32_t y = MCU_row * component->V + mb_i;
+                        const int16_t *source_block;
+                        if (transformer->flip_x) {
+                            x = transformer->flipped_blocks_x[k] - 1 - x;
+                        }
+                        if (transformer->flip_y) {
+                            y = transformer->flipped_blocks_y[k] - 1 - y;
+                        }
+                        source_block = source->coefficients + (size_t) (transformer->transpose ?
+                                x * source->blocks_per_line + y : y * source->blocks_per_line + x) * MB_SQUARE;
+                        for (p = 0; p < MB_SQUARE; ++p) {
+                            block[p] = (int16_t) (source_block[transformer->coefficient_sources[p]] *
+                                                  transformer->coefficient_signs[p]);
+                        }
+                        count_block_symbols(block, &prev_DC[k], band->DC_frequencies[component->table_id],
+                                            band->AC_frequencies[component->table_id]);
+                        block += MB_SQUARE;
+                    }
+                }
+            }
+        }
+    }
+}
+
+/*
+ * Coefficients callback of the source decoder: the whole transform happens while the decoder still has
+ * the coefficients of the frame.
+ */
+int transform_frame(void *arg, const jpeg_decoder *decoder) {
+    jpeg_transformer *transformer = (jpeg_transformer *) arg;
+    jpeg_encoder *encoder = &transformer->encoder;
+    transform_band_task *tasks = NULL;
+    uint32_t b;
+    int ret = 0;
+
+    transformer->decoder = decoder;
+    if (init_transformed_frame(transformer) < 0 || init_bands(encoder) < 0) {
+        goto fail;
+    }
+
+    tasks = (transform_band_task *) malloc(encoder->bands_number * sizeof(transform_band_task));
+    if (!tasks) {
+        PROCESS_ERROR("Couldn't allocate memory for %u bands.\n", encoder->bands_number);
+    }
+    for (b = 0; b < encoder->bands_number; ++b) {
+        tasks[b].transformer = transformer;
+        tasks[b].band = &encoder->bands[b];
+        run_encoder_task(encoder, transform_coefficients_band, &tasks[b]);
+    }
+    wait_encoder_tasks(encoder);
+
+    if (encode_bands(encoder) < 0) {
+        goto fail;
+    }
+
+    goto end;
+
+    fail:
+    ret = -1;
+
+    end:
+    free(tasks);
+    destroy_bands(encoder);
+    transformer->decoder = NULL;
+    return ret;
+}
+
+/*
+ * Transforms the JPEG file in the memory buffer into transformer->encoder.output, which stays valid until
+ * destroy_jpeg_transformer() or the next transform. Baseline and progressive sources are accepted,
+ * the output is always baseline.
+ */
+int transform_JPEG(jpeg_transformer *transformer, const uint8_t *data, size_t data_size) {
+    jpeg_decoder decoder;
+    int ret;
+
+    transformer->transpose = transformer->flip_x = transformer->flip_y = 0;
+    init_coefficient_mapping(transformer);
+    transformer->encoder.pool = transformer->pool;
+    transformer->encoder.optimize_Huffman = transformer->optimize_Huffman;
+    destroy_bitstream_writer(&transformer->encoder.output);
+
+    init_jpeg_decoder(&decoder);
+    decoder.pool = transformer->pool;
+    decoder.verbose = transformer->verbose;
+    decoder.coefficients_callback = transform_frame;
+    decoder.coefficients_callback_arg = transformer;
+    ret = decode_JPEG(&decoder, data, data_size);
+    destroy_jpeg_decoder(&decoder);
+    if (ret == 0 && transformer->encoder.output.size == 0) {
+        PROCESS_ERROR("The file has no complete frame to transform.\n");
+    }
+    return ret;
+
+    fail:
+    return -1;
+}
+
+#endif
@@ -0,0 +1,104 @@
+/*
+ * PNM output of the decoder (P5 grayscale and P6 RGB), written row by row from the row callback.
+ */
+
+#ifndef LAB8_OUTPUT_FILE_H
+#define LAB8_OUTPUT_FILE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "common.h"
+#include "jpeg_decoder.h"
+
+int write_header(FILE *file, char *file_name, char *file_type, int width, int height, int max_value) {
+    if (fprintf(file, "%s\n%d %d\n%d\n", file_type, width, height, max_value) < 0) {
+        fprintf(stderr, "Couldn't write the output file header to the \"%s\".\n", file_name);
+        return -1;
+    }
+    return 0;
+}
+
+int write_data(FILE *file, char *file_name, const uint8_t *data, int data_size) {
+    if (fwrite(data, sizeof(uint8_t), data_size, file) != (size_t) data_size) {
+        fprintf(stderr, "Couldn't write the output file data to the file \"%s\".\n", file_name);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * PNM keeps the samples of more than 8 bits in the big-endian order.
+ */
+int write_data_16(FILE *file, char *file_name, const uint16_t *data, int samples_number) {
+    uint8_t *bytes = (uint8_t *) malloc(samples_number * 2);
+    int ret;
+    int i;
+
+    if (!bytes) {
+        fprintf(stderr, "Couldn't allocate memory for the output rows.\n");
+        return -1;
+    }
+    for (i = 0; i < samples_number; ++i) {
+        bytes[2 * i] = (uint8_t) (data[i] >> 8);
+        bytes[2 * i + 1] = (uint8_t) data[i];
+    }
+    ret = write_data(file, file_name, bytes, samples_number * 2);
+    free(bytes);
+    return ret;
+}
+
+typedef struct output_file {
+    FILE *file;
+    char *file_name;
+    const jpeg_decoder *decoder;
+} output_file;
+
+/*
+ * Row callback of the decoder: the rows are written as soon as they are decoded, the header goes before the first one.
+ * The 12-bit images are written with the maximum value 4095.
+ */
+int write_output_rows(void *arg, const uint8_t *rows, uint32_t first_row, uint32_t rows_number) {
+    output_file *output = (output_file *) arg;
+    const jpeg_decoder *decoder = output->decoder;
+    int samples_number = decoder->output_width * rows_number * decoder->output_components_number;
+
+    if (first_row == 0) {
+        char file_type[3] = "P5";
+        if (decoder->output_components_number == 3) {
+            file_type[1] = '6';
+        }
+        if (write_header(output->file, output->file_name, file_type, decoder->output_width,
+                         decoder->output_height, (1 << decoder->precision) - 1) < 0) {
+            return -1;
+        }
+    }
+    if (decoder->sample_size == 2) {
+        return write_data_16(output->file, output->file_name, (const uint16_t *) rows, samples_number);
+    }
+    return write_data(output->file, output->file_name, rows, samples_number);
+}
+
+/*
+ * Closes the output file and removes it when the decode failed or the file couldn't be closed,
+ * so no partially written image is left. Returns -1 if the file couldn't be closed.
+ */
+int close_output_file(output_file *output, int failed) {
+    int ret = 0;
+
+    if (!output->file) {
+        return 0;
+    }
+    if (fclose(output->file) != 0) {
+        fprintf(stderr, "Couldn't close the output file \"%s\".\n", output->file_name);
+        ret = -1;
+    }
+    output->file = NULL;
+    if ((failed || ret < 0) && remove(output->file_name) != 0) {
+        fprintf(stderr, "Couldn't remove the output file \"%s\" with partially written data.\n", output->file_name);
+    }
+    return ret;
+}
+
+#endif
@@ -0,0 +1,81 @@
+/*
+ * Binary PNM (P5 grayscale and P6 RGB with the maximum value 255) input of the encoder.
+ */
+
+#ifndef LAB8_PNM_H
+#define LAB8_PNM_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <ctype.h>
+
+#include "common.h"
+
+typedef struct pnm_image {
+    const uint8_t *pixels; /* points into the file data */
+    uint16_t width;
+    uint16_t height;
+    uint8_t components_number;
+} pnm_image;
+
+/*
+ * Reads the next decimal number of the header skipping the whitespace and the comments.
+ */
+int read_PNM_number(const uint8_t *data, size_t size, size_t *position, uint32_t *number) {
+    *number = 0;
+    while (*position < size && (isspace(data[*position]) || data[*position] == '#')) {
+        if (data[*position] == '#') {
+            while (*position < size && data[*position] != '\n') {
+                ++*position;
+            }
+        } else {
+            ++*position;
+        }
+    }
+    if (*position >= size || !isdigit(data[*position])) {
+        return -1;
+    }
+    while (*position < size && isdigit(data[*position])) {
+        *number = *number * 10 + (data[*position] - '0');
+        if (*number > UINT16_MAX) {
+            return -1;
+        }
+        ++*position;
+    }
+    return 0;
+}
+
+int parse_PNM(pnm_image *image, const uint8_t *data, size_t size) {
+    size_t position = 2;
+    uint32_t width, height, max_value;
+
+    if (size < 2 || data[0] != 'P' || (data[1] != '5' && data[1] != '6')) {
+        PROCESS_ERROR("Unsupported input format. Must be binary PNM (P5 or P6).\n");
+    }
+    image->components_number = data[1] == '5' ? 1 : 3;
+    if (read_PNM_number(data, size, &position, &width) < 0 ||
+        read_PNM_number(data, size, &position, &height) < 0 ||
+        read_PNM_number(data, size, &position, &max_value) < 0) {
+        PROCESS_ERROR("Incorrect PNM header.\n");
+    }
+    if (width == 0 || height == 0) {
+        PROCESS_ERROR("Incorrect PNM image size %ux%u.\n", width, height);
+    }
+    if (max_value != UINT8_MAX) {
+        PROCESS_ERROR("Unsupported PNM maximum value %u. Must be 255.\n", max_value);
+    }
+    ++position; /* the single whitespace after the header */
+    if (position > size || size - position < (size_t) width * height * image->components_number) {
+        PROCESS_ERROR("PNM data is shorter than the %ux%u image.\n", width, height);
+    }
+
+    image->pixels = data + position;
+    image->width = (uint16_t) width;
+    image->height = (uint16_t) height;
+    return 0;
+
+    fail:
+    return -1;
+}
+
+#endif
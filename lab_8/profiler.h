@@ -0,0 +1,233 @@
+/*
+ * Per-stage timers and counters of the decoder. Every thread accumulates the time of its current stage
+ * in thread-local counters, which are added to the decode profile at the end of every task, so the hot loops
+ * only read the clock when the stage changes. The clock is the time stamp counter where there is one,
+ * its ticks are converted into nanoseconds by the wall time of the whole decode.
+ *
+ * Reading the clock twice per block would cost more than the entropy decode of a sparse block, so only
+ * every PROFILE_SAMPLING_PERIOD-th block is split into its stages. The rest of the blocks are timed
+ * together and their time is divided between the stages in the proportion of the sampled blocks.
+ *
+ * The stage times are summed over all the threads. PROFILING_ENABLE in common.h compiles all of it out.
+ */
+
+#ifndef LAB8_PROFILER_H
+#define LAB8_PROFILER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "common.h"
+
+typedef enum profile_stage {
+    STAGE_MARKERS, /* segment parsing, restart markers included */
+    STAGE_FILTER_SCAN_DATA, /* removing the stuffed bytes of the scan data */
+    STAGE_ENTROPY_DECODE, /* the baseline blocks are dequantized on the way */
+    STAGE_DEQUANTIZATION, /* separate only for the buffered frames */
+    STAGE_IDCT, /* with the level shift of the samples into the planes */
+    STAGE_UPSAMPLE,
+    STAGE_COLOR_CONVERT,
+    STAGE_OUTPUT_WRITE, /* the row callback */
+    PROFILE_STAGES_NUMBER,
+    STAGE_BLOCKS = PROFILE_STAGES_NUMBER, /* the blocks which are not sampled */
+    STAGE_IDLE /* waiting for the other threads or untracked work */
+} profile_stage;
+
+#define PROFILE_SAMPLING_PERIOD 8
+
+static const char *profile_stage_names[PROFILE_STAGES_NUMBER] = {
+        "markers", "filter_scan_data", "entropy_decode", "dequantization", "IDCT", "upsample", "color_convert",
+        "output_write"
+};
+
+typedef struct decode_profile {
+    uint64_t stage_time[PROFILE_STAGES_NUMBER + 1]; /* ticks of get_profile_ticks(), STAGE_BLOCKS included */
+    uint64_t sampled_time[PROFILE_STAGES_NUMBER]; /* of the sampled blocks only */
+    uint64_t blocks_decoded; /* blocks transformed from the whole set of coefficients */
+    uint64_t zero_blocks; /* the ones of them without AC coefficients */
+    uint64_t DC_only_blocks; /* blocks of the thumbnail, their AC coefficients are not decoded */
+    uint64_t wall_time; /* nanoseconds */
+    uint64_t wall_ticks;
+    int threads_number;
+} decode_profile;
+
+typedef struct profile_thread_state {
+    decode_profile *profile; /* where the counters go */
+    int stage;
+    int stage_sampled; /* the stage is a part of the sampled block */
+    uint64_t stage_start;
+    uint32_t blocks_counter; /* chooses the sampled blocks */
+    uint64_t stage_time[PROFILE_STAGES_NUMBER + 1];
+    uint64_t sampled_time[PROFILE_STAGES_NUMBER];
+    uint64_t blocks_decoded;
+    uint64_t zero_blocks;
+    uint64_t DC_only_blocks;
+} profile_thread_state;
+
+static __thread profile_thread_state thread_profile = {NULL, STAGE_IDLE, 0, 0, 0, {0}, {0}, 0, 0, 0};
+
+uint64_t get_profile_time() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t) time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+uint64_t get_profile_ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return get_profile_time();
+#endif
+}
+
+void start_profile(decode_profile *profile, int threads_number) {
+    memset(profile, 0, sizeof(decode_profile));
+    profile->threads_number = threads_number;
+    profile->wall_time = get_profile_time();
+    profile->wall_ticks = get_profile_ticks();
+}
+
+/*
+ * Divides the time of the blocks which are not sampled between the stages, all of it goes to the entropy
+ * decode if there are no samples.
+ */
+void stop_profile(decode_profile *profile) {
+    uint64_t sampled_sum = 0;
+    int i;
+
+    profile->wall_time = get_profile_time() - profile->wall_time;
+    profile->wall_ticks = get_profile_ticks() - profile->wall_ticks;
+
+    for (i = 0; i < PROFILE_STAGES_NUMBER; ++i) {
+        sampled_sum += profile->sampled_time[i];
+    }
+    if (sampled_sum == 0) {
+        profile->stage_time[STAGE_ENTROPY_DECODE] += profile->stage_time[STAGE_BLOCKS];
+    } else {
+        for (i = 0; i < PROFILE_STAGES_NUMBER; ++i) {
+            profile->stage_time[i] += (uint64_t) ((double) profile->stage_time[STAGE_BLOCKS] *
+                                                  profile->sampled_time[i] / sampled_sum);
+        }
+    }
+    profile->stage_time[STAGE_BLOCKS] = 0;
+}
+
+/*
+ * Stage time in milliseconds.
+ */
+double get_stage_time(const decode_profile *profile, int stage) {
+    if (profile->wall_ticks == 0) {
+        return 0;
+    }
+    return profile->stage_time[stage] * ((double) profile->wall_time / profile->wall_ticks) * 1e-6;
+}
+
+/*
+ * Ends the current stage of the thread and starts the next one.
+ */
+void switch_profile_stage(decode_profile *profile, int stage) {
+    uint64_t now = get_profile_ticks();
+    if (thread_profile.stage != STAGE_IDLE) {
+        thread_profile.stage_time[thread_profile.stage] += now - thread_profile.stage_start;
+        if (thread_profile.stage_sampled) {
+            thread_profile.sampled_time[thread_profile.stage] += now - thread_profile.stage_start;
+        }
+    }
+    thread_profile.profile = profile;
+    thread_profile.stage = stage;
+    thread_profile.stage_sampled = 0;
+    thread_profile.stage_start = now;
+}
+
+/*
+ * Stage switch inside the per-block code, the first stage of the block chooses whether it is sampled.
+ * The blocks which are not sampled read the clock only when they follow a sampled one.
+ */
+void switch_block_stage(decode_profile *profile, int stage, int first) {
+    if (first) {
+        ++thread_profile.blocks_counter;
+    }
+    if (thread_profile.blocks_counter % PROFILE_SAMPLING_PERIOD == 0) {
+        switch_profile_stage(profile, stage);
+        thread_profile.stage_sampled = 1;
+    } else if (thread_profile.stage != STAGE_BLOCKS) {
+        switch_profile_stage(profile, STAGE_BLOCKS);
+    }
+}
+
+void count_profile_block(decode_profile *profile, int zero) {
+    thread_profile.profile = profile;
+    ++thread_profile.blocks_decoded;
+    thread_profile.zero_blocks += zero;
+}
+
+void count_profile_DC_only_block(decode_profile *profile) {
+    thread_profile.profile = profile;
+    ++thread_profile.DC_only_blocks;
+}
+
+/*
+ * Adds the counters of the thread to the profile, at the end of every task of the thread pool.
+ */
+void flush_profile() {
+    decode_profile *profile = thread_profile.profile;
+    int i;
+
+    if (!profile) {
+        return;
+    }
+    switch_profile_stage(profile, STAGE_IDLE);
+    for (i = 0; i < PROFILE_STAGES_NUMBER; ++i) {
+        __sync_fetch_and_add(&profile->stage_time[i], thread_profile.stage_time[i]);
+        __sync_fetch_and_add(&profile->sampled_time[i], thread_profile.sampled_time[i]);
+    }
+    __sync_fetch_and_add(&profile->stage_time[STAGE_BLOCKS], thread_profile.stage_time[STAGE_BLOCKS]);
+    __sync_fetch_and_add(&profile->blocks_decoded, thread_profile.blocks_decoded);
+    __sync_fetch_and_add(&profile->zero_blocks, thread_profile.zero_blocks);
+    __sync_fetch_and_add(&profile->DC_only_blocks, thread_profile.DC_only_blocks);
+    memset(thread_profile.stage_time, 0, sizeof(thread_profile.stage_time));
+    memset(thread_profile.sampled_time, 0, sizeof(thread_profile.sampled_time));
+    thread_profile.blocks_decoded = 0;
+    thread_profile.zero_blocks = 0;
+    thread_profile.DC_only_blocks = 0;
+}
+
+void print_profile_JSON(FILE *file, const decode_profile *profile) {
+    uint64_t blocks = profile->blocks_decoded;
+    int i;
+
+    fprintf(file, "{\n  \"wall_time_ms\": %.3f,\n  \"threads\": %d,\n  \"stage_time_ms\": {\n",
+            profile->wall_time * 1e-6, profile->threads_number);
+    for (i = 0; i < PROFILE_STAGES_NUMBER; ++i) {
+        fprintf(file, "    \"%s\": %.3f%s\n", profile_stage_names[i], get_stage_time(profile, i),
+                i + 1 < PROFILE_STAGES_NUMBER ? "," : "");
+    }
+    fprintf(file, "  },\n  \"blocks_decoded\": %llu,\n  \"zero_blocks\": %llu,\n  \"zero_block_ratio\": %.4f,\n"
+                  "  \"DC_only_blocks\": %llu\n}\n",
+            (unsigned long long) blocks, (unsigned long long) profile->zero_blocks,
+            blocks ? (double) profile->zero_blocks / blocks : 0., (unsigned long long) profile->DC_only_blocks);
+}
+
+#if PROFILING_ENABLE
+#define PROFILE_STAGE(decoder, stage) { if ((decoder)->profiling) switch_profile_stage(&(decoder)->profile, stage); }
+#define PROFILE_BLOCK_STAGE(decoder, stage, first) { \
+    if ((decoder)->profiling) switch_block_stage(&(decoder)->profile, stage, first); \
+}
+#define PROFILE_BLOCK(decoder, zero) { if ((decoder)->profiling) count_profile_block(&(decoder)->profile, zero); }
+#define PROFILE_DC_ONLY_BLOCK(decoder) { if ((decoder)->profiling) count_profile_DC_only_block(&(decoder)->profile); }
+#define PROFILE_FLUSH(decoder) { if ((decoder)->profiling) flush_profile(); }
+#else
+#define PROFILE_STAGE(decoder, stage)
+#define PROFILE_BLOCK_STAGE(decoder, stage, first)
+#define PROFILE_BLOCK(decoder, zero)
+#define PROFILE_DC_ONLY_BLOCK(decoder)
+#define PROFILE_FLUSH(decoder)
+#endif
+
+#endif
@@ -0,0 +1,122 @@
+/*
+ * Decoding of the progressive DCT (SOF2) scans into the quantized coefficient blocks.
+ * Every block is stored in the natural order, a scan adds either new bits or new coefficients to it.
+ */
+
+#ifndef LAB8_PROGRESSIVE_DECODER_H
+#define LAB8_PROGRESSIVE_DECODER_H
+
+#include "jpeg_tables.h"
+#include "bitstream_reader.h"
+#include "huffman_decoder.h"
+
+void decode_DC_first(bitstream_reader *bit_ctx, Huffman_node *huffman_tree_DC,
+                     int16_t *block, int *prev_DC, uint8_t Al) {
+    uint16_t DC_length;
+    decode_value(bit_ctx, huffman_tree_DC, &DC_length);
+    *prev_DC += read_signed_value(bit_ctx, DC_length);
+    block[0] = (int16_t) (*prev_DC * (1 << Al));
+}
+
+void decode_DC_refine(bitstream_reader *bit_ctx, int16_t *block, uint8_t Al) {
+    if (read_bits_8bit(bit_ctx, 1)) {
+        block[0] |= (int16_t) (1 << Al);
+    }
+}
+
+void decode_AC_first(bitstream_reader *bit_ctx, Huffman_node *huffman_tree_AC, int16_t *block,
+                     uint8_t Ss, uint8_t Se, uint8_t Al, uint32_t *EOB_run) {
+    int k;
+
+    if (*EOB_run > 0) { /* The block is inside of the band of empty blocks */
+        --*EOB_run;
+        return;
+    }
+
+    for (k = Ss; k <= Se; ++k) {
+        uint16_t x;
+        uint8_t zeros, AC_length;
+
+        decode_value(bit_ctx, huffman_tree_AC, &x);
+        zeros = (x & 0xF0) >> 4;
+        AC_length = x & 0x0F;
+
+        if (AC_length != 0) {
+            k += zeros;
+            block[reverse_zig_zag[k]] = (int16_t) (read_signed_value(bit_ctx, AC_length) * (1 << Al));
+        } else if (zeros == 15) { /* ZRL: 16 zero coefficients */
+            k += 15;
+        } else { /* EOBn: the rest of this block and 2^n + extra - 1 next blocks are empty */
+            *EOB_run = (1 << zeros) - 1;
+            if (zeros != 0) {
+                *EOB_run += read_bits_16bit(bit_ctx, zeros);
+            }
+            break;
+        }
+    }
+}
+
+/*
+ * Appends a correction bit to the already non-zero coefficient.
+ */
+void refine_coefficient(bitstream_reader *bit_ctx, int16_t *coefficient, int p1) {
+    if (read_bits_8bit(bit_ctx, 1) && (*coefficient & p1) == 0) {
+        if (*coefficient >= 0) {
+            *coefficient += p1;
+        } else {
+            *coefficient -= p1;
+        }
+    }
+}
+
+void decode_AC_refine(bitstream_reader *bit_ctx, Huffman_node *huffman_tree_AC, int16_t *block,
+                      uint8_t Ss, uint8_t Se, uint8_t Al, uint32_t *EOB_run) {
+    int p1 = 1 << Al;
+    int k = Ss;
+
+    if (*EOB_run == 0) {
+        for (; k <= Se; ++k) {
+            uint16_t x;
+            int zeros;
+            int value = 0;
+
+            decode_value(bit_ctx, huffman_tree_AC, &x);
+            zeros = (x & 0xF0) >> 4;
+
+            if ((x & 0x0F) != 0) { /* New coefficient, its magnitude is always 1 */
+                value = read_bits_8bit(bit_ctx, 1) ? p1 : -p1;
+            } else if (zeros != 15) { /* EOBn */
+                *EOB_run = 1 << zeros;
+                if (zeros != 0) {
+                    *EOB_run += read_bits_16bit(bit_ctx, zeros);
+                }
+                break;
+            }
+
+            /* Skip the zero run refining the non-zero coefficients on the way */
+            for (; k <= Se; ++k) {
+                int16_t *coefficient = &block[reverse_zig_zag[k]];
+                if (*coefficient != 0) {
+                    refine_coefficient(bit_ctx, coefficient, p1);
+                } else if (--zeros < 0) {
+                    break;
+                }
+            }
+            if (value != 0 && k <= Se) {
+                block[reverse_zig_zag[k]] = (int16_t) value;
+            }
+        }
+    }
+
+    if (*EOB_run > 0) { /* Only the refinement bits are left in the block */
+        for (; k <= Se; ++k) {
+            int16_t *coefficient = &block[reverse_zig_zag[k]];
+            if (*coefficient != 0) {
+                refine_coefficient(bit_ctx, coefficient, p1);
+            }
+        }
+        --*EOB_run;
+    }
+}
+
+#endif
@@ -0,0 +1,191 @@
+/*
+ * Simple fixed-size pool of worker threads with a shared FIFO of tasks. Every task belongs to a group,
+ * so the users of one pool wait only for their own tasks. A thread waiting for its group runs the queued tasks
+ * meanwhile, so a task can submit and wait for the tasks of its own group on the same pool.
+ */
+
+#ifndef LAB8_THREAD_POOL_H
+#define LAB8_THREAD_POOL_H
+
+#include <pthread.h>
+#include <unistd.h>
+
+typedef void (*thread_pool_function)(void *arg);
+
+/*
+ * Tasks of one decode or encode, zero-initialized by its owner.
+ */
+typedef struct thread_pool_group {
+    uint32_t tasks_pending; /* submitted and not finished, guarded by the pool mutex */
+} thread_pool_group;
+
+typedef struct thread_pool_task {
+    thread_pool_function function;
+    void *arg;
+    thread_pool_group *group;
+} thread_pool_task;
+
+typedef struct thread_pool {
+    pthread_t *threads;
+    int threads_number;
+    thread_pool_task *tasks; /* ring buffer of pending tasks */
+    uint32_t tasks_capacity;
+    uint32_t tasks_head;
+    uint32_t tasks_number;
+    int stop;
+    pthread_mutex_t mutex;
+    pthread_cond_t task_available;
+    pthread_cond_t tasks_done; /* a group has no pending tasks anymore */
+} thread_pool;
+
+int get_cpu_number() {
+    long cpu_number = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpu_number > 0 ? (int) cpu_number : 1;
+}
+
+/*
+ * Takes the first queued task and runs it, the pool mutex is locked before and after.
+ */
+void run_next_task(thread_pool *pool) {
+    thread_pool_task task = pool->tasks[pool->tasks_head];
+
+    pool->tasks_head = (pool->tasks_head + 1) % pool->tasks_capacity;
+    --pool->tasks_number;
+    pthread_mutex_unlock(&pool->mutex);
+
+    task.function(task.arg);
+
+    pthread_mutex_lock(&pool->mutex);
+    if (--task.group->tasks_pending == 0) {
+        pthread_cond_broadcast(&pool->tasks_done);
+    }
+}
+
+void *thread_pool_worker(void *arg) {
+    thread_pool *pool = (thread_pool *) arg;
+
+    pthread_mutex_lock(&pool->mutex);
+    while (1) {
+        while (pool->tasks_number == 0 && !pool->stop) {
+            pthread_cond_wait(&pool->task_available, &pool->mutex);
+        }
+        if (pool->tasks_number == 0) { /* Stopped and nothing left to do */
+            break;
+        }
+        run_next_task(pool);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return NULL;
+}
+
+void destroy_thread_pool(thread_pool *pool) {
+    int i;
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->task_available);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (i = 0; i < pool->threads_number; ++i) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    pthread_cond_destroy(&pool->tasks_done);
+    pthread_cond_destroy(&pool->task_available);
+    pthread_mutex_destroy(&pool->mutex);
+    free(pool->threads);
+    free(pool->tasks);
+}
+
+/*
+ * Pool with threads_number <= 1 has no worker threads: tasks are executed right in submit_task().
+ * On failure the started threads are stopped and the pool needs no destroy_thread_pool().
+ */
+int init_thread_pool(thread_pool *pool, int threads_number) {
+    int i;
+
+    pool->threads = NULL;
+    pool->threads_number = 0;
+    pool->tasks_capacity = 16;
+    pool->tasks_head = 0;
+    pool->tasks_number = 0;
+    pool->stop = 0;
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->task_available, NULL);
+    pthread_cond_init(&pool->tasks_done, NULL);
+    pool->tasks = (thread_pool_task *) malloc(pool->tasks_capacity * sizeof(thread_pool_task));
+    if (!pool->tasks) {
+        goto fail;
+    }
+
+    if (threads_number <= 1) {
+        return 0;
+    }
+    pool->threads = (pthread_t *) malloc(threads_number * sizeof(pthread_t));
+    if (!pool->threads) {
+        goto fail;
+    }
+    for (i = 0; i < threads_number; ++i) {
+        if (pthread_create(&pool->threads[i], NULL, thread_pool_worker, pool) != 0) {
+            goto fail;
+        }
+        ++pool->threads_number;
+    }
+    return 0;
+
+    fail:
+    destroy_thread_pool(pool);
+    return -1;
+}
+
+void submit_task(thread_pool *pool, thread_pool_group *group, thread_pool_function function, void *arg) {
+    uint32_t tail;
+
+    if (pool->threads_number == 0) {
+        function(arg);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    if (pool->tasks_number == pool->tasks_capacity) { /* Grow the ring buffer preserving the order */
+        uint32_t new_capacity = pool->tasks_capacity * 2;
+        thread_pool_task *new_tasks = (thread_pool_task *) malloc(new_capacity * sizeof(thread_pool_task));
+        uint32_t i;
+        if (!new_tasks) { /* The task still gets done, only without the workers */
+            pthread_mutex_unlock(&pool->mutex);
+            function(arg);
+            return;
+        }
+        for (i = 0; i < pool->tasks_number; ++i) {
+            new_tasks[i] = pool->tasks[(pool->tasks_head + i) % pool->tasks_capacity];
+        }
+        free(pool->tasks);
+        pool->tasks = new_tasks;
+        pool->tasks_capacity = new_capacity;
+        pool->tasks_head = 0;
+    }
+    tail = (pool->tasks_head + pool->tasks_number) % pool->tasks_capacity;
+    pool->tasks[tail].function = function;
+    pool->tasks[tail].arg = arg;
+    pool->tasks[tail].group = group;
+    ++pool->tasks_number;
+    ++group->tasks_pending;
+    pthread_cond_signal(&pool->task_available);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+/*
+ * Blocks until all the tasks of the group are finished, running the queued tasks of any group meanwhile.
+ */
+void wait_thread_pool(thread_pool *pool, thread_pool_group *group) {
+    pthread_mutex_lock(&pool->mutex);
+    while (group->tasks_pending != 0) {
+        if (pool->tasks_number != 0) {
+            run_next_task(pool);
+        } else {
+            pthread_cond_wait(&pool->tasks_done, &pool->mutex);
+        }
+    }
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+#endif
@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "common.h"
+#include "thread_pool.h"
+#include "input_file.h"
+#include "jpeg_transform.h"
+
+int parse_args(int argc, char **argv, jpeg_transformer *transformer, int *threads_number,
+               char **input_file_name, char **output_file_name) {
+    int option;
+
+    *threads_number = get_cpu_number();
+    while ((option = getopt(argc, argv, "r:f:t:ov")) != -1) {
+        if (option == 'r' || option == 'f') {
+            if (transformer->transform != TRANSFORM_NONE) {
+                PROCESS_ERROR("Only one rotation or flip can be done at a time.\n");
+            }
+            if (option == 'r' && strcmp(optarg, "90") == 0) {
+                transformer->transform = TRANSFORM_ROTATE_90;
+            } else if (option == 'r' && strcmp(optarg, "180") == 0) {
+                transformer->transform = TRANSFORM_ROTATE_180;
+            } else if (option == 'r' && strcmp(optarg, "270") == 0) {
+                transformer->transform = TRANSFORM_ROTATE_270;
+            } else if (option == 'f' && strcmp(optarg, "h") == 0) {
+                transformer->transform = TRANSFORM_FLIP_HORIZONTAL;
+            } else if (option == 'f' && strcmp(optarg, "v") == 0) {
+                transformer->transform = TRANSFORM_FLIP_VERTICAL;
+            } else if (option == 'r') {
+                PROCESS_ERROR("Incorrect rotation angle \"%s\". Must be 90, 180 or 270.\n", optarg);
+            } else {
+                PROCESS_ERROR("Incorrect flip \"%s\". Must be h or v.\n", optarg);
+            }
+        } else if (option == 't') {
+            *threads_number = atoi(optarg);
+            if (*threads_number <= 0) {
+                PROCESS_ERROR("Incorrect number of threads \"%s\". Must be more than 0.\n", optarg);
+            }
+        } else if (option == 'o') {
+            transformer->optimize_Huffman = 1;
+        } else if (option == 'v') {
+            transformer->verbose = 1;
+        } else {
+            goto fail;
+        }
+    }
+    if (argc - optind != 2) {
+        PROCESS_ERROR("Incorrect number of arguments.\n");
+    }
+    *input_file_name = argv[optind];
+    *output_file_name = argv[optind + 1];
+
+    goto end;
+
+    fail:
+    fprintf(stderr, "Usage: %s [-r 90|180|270] [-f h|v] [-t threads_number] [-o] [-v] <input_file_name|-> <output_file_name>\n", argv[0]);
+    return -1;
+
+    end:
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    char *input_file_name;
+    char *output_file_name;
+    input_file input;
+    jpeg_transformer transformer;
+    FILE *output_file = NULL;
+    int threads_number;
+    thread_pool pool;
+    int pool_started = 0;
+
+    int ret = 0;
+
+    input.data = NULL;
+    input.mapped = 0;
+    init_jpeg_transformer(&transformer);
+    if (parse_args(argc, argv, &transformer, &threads_number, &input_file_name, &output_file_name) < 0) {
+        goto fail;
+    }
+
+    if (open_input_file(&input, input_file_name) < 0) {
+        goto fail;
+    }
+
+    if (init_thread_pool(&pool, threads_number) < 0) {
+        PROCESS_ERROR("Couldn't start %d threads.\n", threads_number);
+    }
+    pool_started = 1;
+    transformer.pool = &pool;
+
+    if (transform_JPEG(&transformer, input.data, input.size) < 0) {
+        goto fail;
+    }
+
+    output_file = fopen(output_file_name, "wb");
+    if (!output_file) {
+        PROCESS_ERROR("Couldn't open the output file \"%s\".\n", output_file_name);
+    }
+    if (fwrite(transformer.encoder.output.buffer, sizeof(uint8_t), transformer.encoder.output.size, output_file) !=
+        transformer.encoder.output.size) {
+        PROCESS_ERROR("Couldn't write the output file \"%s\".\n", output_file_name);
+    }
+
+    goto end;
+
+    fail:
+    ret = 1;
+
+    end:
+    if (pool_started) {
+        destroy_thread_pool(&pool);
+    }
+    destroy_jpeg_transformer(&transformer);
+    close_input_file(&input);
+
+    if (output_file && fclose(output_file) != 0) {
+        fprintf(stderr, "Couldn't close the output file \"%s\".\n", output_file_name);
+        ret = 1;
+    }
+    return ret;
+}
@@ -3,6 +3,14 @@
 
 #include "common.h"
 
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#define ROW_WEIGHT_BITS 7     /* vertical pass keeps 8 + 7 bits, so it fits into a signed 16-bit value */
+#define COLUMN_WEIGHT_BITS 8
+#define UPSCALE_SCRATCH_PADDING 16
+
 #define SIGN(x) (((x) > 0) - ((x) < 0))
 
 void get_neighbours(double x, int32_t side_length, double *left_neighbour, double *right_neighbour) {
@@ -40,14 +48,6 @@ double calc_rate(double d) {
     return rate;
 }
 
-double linear_interpolation(double left_pixel, double right_pixel,
-                            double left_pos, double right_pos,
-                            double point) {
-    double left_rate = calc_rate(left_pos - point);
-    double right_rate = calc_rate(right_pos - point);
-    return (left_rate * left_pixel + right_rate * right_pixel) / (left_rate + right_rate);
-}
-
 double pixel_to_position(int32_t pixel, int32_t side_length) {
     double center = (double) side_length / 2;
     double pos = pixel - center;
@@ -66,51 +66,358 @@ int32_t position_to_pixel(double x, int32_t side_length) {
     return CLIP(0, pixel, side_length - 1);
 }
 
-uint8_t bilinear_interpolation(int32_t w_pos, int32_t h_pos,
-                               const uint8_t *input, uint16_t in_width, uint16_t in_height,
-                               uint16_t out_width, uint16_t out_height) {
-#define AT(w, h) (input[(h) * in_width + (w)] / 255.0)
+/*
+ * Bilinear upscaling is separable: every output column (row) is a weighted sum of two neighbour input
+ * columns (rows). The neighbours and the weights depend only on the sizes, so they are computed once.
+ */
+typedef struct upscale_tables {
+    uint16_t in_width;
+    uint16_t in_height;
+    uint16_t out_width;
+    uint16_t out_height;
+    uint16_t in_rows_stored; /* the input is a ring buffer of this many rows, in_height when it is stored whole */
+    int32_t *column_indexes; /* left neighbour, the right one is the next column or has zero weight */
+    int32_t *column_weights; /* (2^COLUMN_WEIGHT_BITS - w) in the low and w in the high 16 bits */
+    int32_t *row_indexes;
+    int16_t *row_weights;
+} upscale_tables;
 
+/*
+ * Finds the neighbours of the output pixel on the input axis and the fixed-point weight of the second one.
+ */
+void fill_axis_table(int32_t out_pixel, int32_t in_length, int32_t out_length, int weight_bits,
+                     int32_t *index, int32_t *weight) {
     double left_pos, right_pos;
-    double down_pos, up_pos;
+    double left_rate, right_rate;
     int32_t left_pixel, right_pixel;
-    int32_t down_pixel, up_pixel;
-    double left_down_pixel, right_down_pixel;
-    double left_up_pixel, right_up_pixel;
-    double down_result, up_result;
-    double result;
+    double pos = pixel_to_position(out_pixel, out_length) * in_length / out_length;
 
-    double w_pos_in = pixel_to_position(w_pos, out_width) * in_width / out_width;
-    double h_pos_in = pixel_to_position(h_pos, out_height) * in_height / out_height;
+    get_neighbours(pos, in_length, &left_pos, &right_pos);
+    left_pixel = position_to_pixel(left_pos, in_length);
+    right_pixel = position_to_pixel(right_pos, in_length);
+    left_rate = calc_rate(left_pos - pos);
+    right_rate = calc_rate(right_pos - pos);
 
-    get_neighbours(w_pos_in, in_width, &left_pos, &right_pos);
-    get_neighbours(h_pos_in, in_height, &down_pos, &up_pos);
+    *index = left_pixel;
+    if (right_pixel == left_pixel) { /* Clipped on the border */
+        *weight = 0;
+    } else {
+        assert(right_pixel == left_pixel + 1);
+        *weight = (int32_t) floor(right_rate / (left_rate + right_rate) * (1 << weight_bits) + 0.5);
+    }
+}
 
-    down_pixel = position_to_pixel(down_pos, in_height);
-    left_pixel = position_to_pixel(left_pos, in_width);
-    up_pixel = position_to_pixel(up_pos, in_height);
-    right_pixel = position_to_pixel(right_pos, in_width);
+int init_upscale_tables(upscale_tables *tables, uint16_t in_width, uint16_t in_height,
+                        uint16_t out_width, uint16_t out_height) {
+    int32_t i;
 
-    left_down_pixel = AT(left_pixel, down_pixel);
-    right_down_pixel = AT(right_pixel, down_pixel);
-    left_up_pixel = AT(left_pixel, up_pixel);
-    right_up_pixel = AT(right_pixel, up_pixel);
+    tables->in_width = in_width;
+    tables->in_height = in_height;
+    tables->out_width = out_width;
+    tables->out_height = out_height;
+    tables->in_rows_stored = in_height;
+    tables->column_indexes = (int32_t *) malloc(out_width * sizeof(int32_t));
+    tables->column_weights = (int32_t *) malloc(out_width * sizeof(int32_t));
+    tables->row_indexes = (int32_t *) malloc(out_height * sizeof(int32_t));
+    tables->row_weights = (int16_t *) malloc(out_height * sizeof(int16_t));
+    if (!tables->column_indexes || !tables->column_weights || !tables->row_indexes || !tables->row_weights) {
+        return -1;
+    }
 
-    down_result = linear_interpolation(left_down_pixel, right_down_pixel, left_pos, right_pos, w_pos_in);
-    up_result = linear_interpolation(left_up_pixel, right_up_pixel, left_pos, right_pos, w_pos_in);
+    for (i = 0; i < out_width; ++i) {
+        int32_t weight;
+        fill_axis_table(i, in_width, out_width, COLUMN_WEIGHT_BITS, &tables->column_indexes[i], &weight);
+        tables->column_weights[i] = ((1 << COLUMN_WEIGHT_BITS) - weight) | (weight << 16);
+    }
+    for (i = 0; i < out_height; ++i) {
+        int32_t weight;
+        fill_axis_table(i, in_height, out_height, ROW_WEIGHT_BITS, &tables->row_indexes[i], &weight);
+        tables->row_weights[i] = (int16_t) weight;
+    }
+    return 0;
+}
 
-    result = linear_interpolation(down_result, up_result, down_pos, up_pos, h_pos_in);
+void destroy_upscale_tables(upscale_tables *tables) {
+    free(tables->column_indexes);
+    free(tables->column_weights);
+    free(tables->row_indexes);
+    free(tables->row_weights);
+}
 
-    return (uint8_t) (CLIP(0, round(result * 255), 255));
+/*
+ * Size of the scratch buffer needed by upscale_row().
+ */
+size_t get_upscale_scratch_size(const upscale_tables *tables) {
+    return (tables->in_width + UPSCALE_SCRATCH_PADDING) * sizeof(int16_t);
 }
 
-void upscale(const uint8_t *input, uint16_t in_width, uint16_t in_height,
-             uint8_t *output, uint16_t out_width, uint16_t out_height) {
-    int i, j;
-    for (i = 0; i < out_height; ++i) {
-        for (j = 0; j < out_width; ++j) {
-            output[i * out_width + j] = bilinear_interpolation(j, i, input, in_width, in_height, out_width, out_height);
+void interpolate_rows(const uint8_t *top, const uint8_t *bottom, int16_t weight, int width, int16_t *output) {
+    int16_t top_weight = (int16_t) ((1 << ROW_WEIGHT_BITS) - weight);
+    int i = 0;
+#ifdef __AVX2__
+    __m256i top_weights = _mm256_set1_epi16(top_weight);
+    __m256i bottom_weights = _mm256_set1_epi16(weight);
+    for (; i + 16 <= width; i += 16) {
+        __m256i top_values = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (top + i)));
+        __m256i bottom_values = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (bottom + i)));
+        _mm256_storeu_si256((__m256i *) (output + i),
+                            _mm256_add_epi16(_mm256_mullo_epi16(top_values, top_weights),
+                                             _mm256_mullo_epi16(bottom_values, bottom_weights)));
+    }
+#endif
+    for (; i < width; ++i) {
+        output[i] = (int16_t) (top[i] * top_weight + bottom[i] * weight);
+    }
+}
+
+#define UPSCALE_ROUNDING (1 << (ROW_WEIGHT_BITS + COLUMN_WEIGHT_BITS - 1))
+
+void interpolate_columns(const int16_t *input, const upscale_tables *tables, uint8_t *output) {
+    int i = 0;
+#ifdef __AVX2__
+    const __m256i rounding = _mm256_set1_epi32(UPSCALE_ROUNDING);
+    for (; i + 16 <= tables->out_width; i += 16) {
+        /* One 32-bit gather brings both neighbours, multiply-add applies both weights */
+        __m256i pairs_0 = _mm256_i32gather_epi32((const int *) input,
+                                                 _mm256_loadu_si256((const __m256i *) (tables->column_indexes + i)), 2);
+        __m256i pairs_1 = _mm256_i32gather_epi32((const int *) input,
+                                                 _mm256_loadu_si256((const __m256i *) (tables->column_indexes + i + 8)), 2);
+        __m256i sums_0 = _mm256_madd_epi16(pairs_0, _mm256_loadu_si256((const __m256i *) (tables->column_weights + i)));
+        __m256i sums_1 = _mm256_madd_epi16(pairs_1,
+                                           _mm256_loadu_si256((const __m256i *) (tables->column_weights + i + 8)));
+        __m256i words;
+        sums_0 = _mm256_srai_epi32(_mm256_add_epi32(sums_0, rounding), ROW_WEIGHT_BITS + COLUMN_WEIGHT_BITS);
+        sums_1 = _mm256_srai_epi32(_mm256_add_epi32(sums_1, rounding), ROW_WEIGHT_BITS + COLUMN_WEIGHT_BITS);
+        words = _mm256_permute4x64_epi64(_mm256_packs_epi32(sums_0, sums_1), _MM_SHUFFLE(3, 1, 2, 0));
+        words = _mm256_permute4x64_epi64(_mm256_packus_epi16(words, words), _MM_SHUFFLE(3, 1, 2, 0));
+        _mm_storeu_si128((__m128i *) (output + i), _mm256_castsi256_si128(words));
+    }
+#endif
+    for (; i < tables->out_width; ++i) {
+        int32_t index = tables->column_indexes[i];
+        int32_t weight = tables->column_weights[i] >> 16;
+        int32_t sum = input[index] * ((1 << COLUMN_WEIGHT_BITS) - weight) + input[index + 1] * weight;
+        output[i] = (uint8_t) CLIP(0, (sum + UPSCALE_ROUNDING) >> (ROW_WEIGHT_BITS + COLUMN_WEIGHT_BITS), 255);
+    }
+}
+
+/*
+ * Upsampling by exactly 2 times is bilinear interpolation with the fixed weights 3/4 and 1/4 of
+ * the nearest and the next nearest input samples ("fancy upsampling"), computed in integers.
+ * Vector kernels handle the inner samples, the borders are clipped by the scalar code.
+ */
+#define UPSAMPLE_H2(i)                                                        \
+    {                                                                         \
+        int left = input[MAX((i) - 1, 0)];                                    \
+        int right = input[MIN((i) + 1, in_width - 1)];                        \
+        output[2 * (i)] = (uint8_t) ((3 * input[i] + left + 2) >> 2);         \
+        output[2 * (i) + 1] = (uint8_t) ((3 * input[i] + right + 2) >> 2);   \
+    }
+
+void upsample_row_h2(const uint8_t *input, int in_width, uint8_t *output) {
+    int i = 0;
+#ifdef __AVX2__
+    const __m256i interleave = _mm256_setr_epi8(0, 8, 1, 9, 2, 10, 3, 11, 4, 12, 5, 13, 6, 14, 7, 15,
+                                                0, 8, 1, 9, 2, 10, 3, 11, 4, 12, 5, 13, 6, 14, 7, 15);
+    const __m256i two = _mm256_set1_epi16(2);
+    if (in_width >= 17) {
+        UPSAMPLE_H2(0)
+    }
+    for (i = 1; i + 17 <= in_width; i += 16) {
+        __m256i center = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (input + i)));
+        __m256i left = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (input + i - 1)));
+        __m256i right = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (input + i + 1)));
+        __m256i center_3 = _mm256_add_epi16(_mm256_add_epi16(center, center), _mm256_add_epi16(center, two));
+        __m256i even = _mm256_srli_epi16(_mm256_add_epi16(center_3, left), 2);
+        __m256i odd = _mm256_srli_epi16(_mm256_add_epi16(center_3, right), 2);
+        _mm256_storeu_si256((__m256i *) (output + 2 * i),
+                            _mm256_shuffle_epi8(_mm256_packus_epi16(even, odd), interleave));
+    }
+    if (i == 1) { /* Too short for the vector loop */
+        i = 0;
+    }
+#endif
+    for (; i < in_width; ++i) {
+        UPSAMPLE_H2(i)
+    }
+}
+
+#undef UPSAMPLE_H2
+
+void upsample_row_v2(const uint8_t *near, const uint8_t *far, int width, uint8_t *output) {
+    int i = 0;
+#ifdef __AVX2__
+    const __m256i two = _mm256_set1_epi16(2);
+    for (; i + 16 <= width; i += 16) {
+        __m256i near_values = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (near + i)));
+        __m256i far_values = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (far + i)));
+        __m256i sum = _mm256_add_epi16(_mm256_add_epi16(near_values, near_values),
+                                       _mm256_add_epi16(_mm256_add_epi16(near_values, far_values), two));
+        sum = _mm256_srli_epi16(sum, 2);
+        sum = _mm256_permute4x64_epi64(_mm256_packus_epi16(sum, sum), _MM_SHUFFLE(3, 1, 2, 0));
+        _mm_storeu_si128((__m128i *) (output + i), _mm256_castsi256_si128(sum));
+    }
+#endif
+    for (; i < width; ++i) {
+        output[i] = (uint8_t) ((3 * near[i] + far[i] + 2) >> 2);
+    }
+}
+
+#define COLUMN_SUM(i) (3 * near[i] + far[i])
+#define UPSAMPLE_H2V2(i)                                                      \
+    {                                                                         \
+        int left = COLUMN_SUM(MAX((i) - 1, 0));                               \
+        int right = COLUMN_SUM(MIN((i) + 1, in_width - 1));                   \
+        output[2 * (i)] = (uint8_t) ((3 * COLUMN_SUM(i) + left + 8) >> 4);    \
+        output[2 * (i) + 1] = (uint8_t) ((3 * COLUMN_SUM(i) + right + 8) >> 4); \
+    }
+
+void upsample_row_h2v2(const uint8_t *near, const uint8_t *far, int in_width, uint8_t *output) {
+    int i = 0;
+#ifdef __AVX2__
+#define COLUMN_SUM_16(offset) _mm256_add_epi16(                                                           \
+        _mm256_mullo_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (near + (offset)))), three), \
+        _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (far + (offset)))))
+    const __m256i interleave = _mm256_setr_epi8(0, 8, 1, 9, 2, 10, 3, 11, 4, 12, 5, 13, 6, 14, 7, 15,
+                                                0, 8, 1, 9, 2, 10, 3, 11, 4, 12, 5, 13, 6, 14, 7, 15);
+    const __m256i three = _mm256_set1_epi16(3);
+    const __m256i eight = _mm256_set1_epi16(8);
+    if (in_width >= 17) {
+        UPSAMPLE_H2V2(0)
+    }
+    for (i = 1; i + 17 <= in_width; i += 16) {
+        __m256i center = _mm256_add_epi16(_mm256_mullo_epi16(COLUMN_SUM_16(i), three), eight);
+        __m256i even = _mm256_srli_epi16(_mm256_add_epi16(center, COLUMN_SUM_16(i - 1)), 4);
+        __m256i odd = _mm256_srli_epi16(_mm256_add_epi16(center, COLUMN_SUM_16(i + 1)), 4);
+        _mm256_storeu_si256((__m256i *) (output + 2 * i),
+                            _mm256_shuffle_epi8(_mm256_packus_epi16(even, odd), interleave));
+    }
+#undef COLUMN_SUM_16
+    if (i == 1) { /* Too short for the vector loop */
+        i = 0;
+    }
+#endif
+    for (; i < in_width; ++i) {
+        UPSAMPLE_H2V2(i)
+    }
+}
+
+#undef UPSAMPLE_H2V2
+#undef COLUMN_SUM
+
+const uint8_t *get_input_row(const upscale_tables *tables, const uint8_t *input, int32_t row) {
+    return input + (row % tables->in_rows_stored) * tables->in_width;
+}
+
+/*
+ * Computes one row of the upscaled plane, scratch must hold get_upscale_scratch_size() bytes.
+ */
+void upscale_row(const upscale_tables *tables, const uint8_t *input, int row, int16_t *scratch, uint8_t *output) {
+    uint16_t in_width = tables->in_width;
+    uint16_t in_height = tables->in_height;
+    int32_t top_row, bottom_row;
+
+    if (tables->out_width == 2 * in_width && tables->out_height == in_height) {
+        upsample_row_h2(get_input_row(tables, input, row), in_width, output);
+        return;
+    }
+    if ((tables->out_width == 2 * in_width || tables->out_width == in_width) && tables->out_height == 2 * in_height) {
+        /* Even output rows lie above the input row centers, odd ones below */
+        const uint8_t *near = get_input_row(tables, input, row / 2);
+        const uint8_t *far = get_input_row(tables, input,
+                                           (row & 1) ? MIN(row / 2 + 1, in_height - 1) : MAX(row / 2 - 1, 0));
+        if (tables->out_width == in_width) {
+            upsample_row_v2(near, far, in_width, output);
+        } else {
+            upsample_row_h2v2(near, far, in_width, output);
         }
+        return;
+    }
+
+    top_row = tables->row_indexes[row];
+    bottom_row = tables->row_weights[row] != 0 ? top_row + 1 : top_row;
+    interpolate_rows(get_input_row(tables, input, top_row), get_input_row(tables, input, bottom_row),
+                     tables->row_weights[row], in_width, scratch);
+    scratch[in_width] = scratch[in_width - 1]; /* The right neighbour of the last column is read with zero weight */
+    interpolate_columns(scratch, tables, output);
+}
+
+/*
+ * Samples of more than 8 bits (the 12-bit frames) are upscaled by the scalar code with the same tables
+ * and the same fixed weights, the intermediate sums of up to 12 + 15 bits are kept in 32 bits.
+ */
+size_t get_upscale_scratch_size_16(const upscale_tables *tables) {
+    return (tables->in_width + UPSCALE_SCRATCH_PADDING) * sizeof(int32_t);
+}
+
+const uint16_t *get_input_row_16(const upscale_tables *tables, const uint16_t *input, int32_t row) {
+    return input + (row % tables->in_rows_stored) * tables->in_width;
+}
+
+void upsample_row_h2_16(const uint16_t *input, int in_width, uint16_t *output) {
+    int i;
+    for (i = 0; i < in_width; ++i) {
+        int left = input[MAX(i - 1, 0)];
+        int right = input[MIN(i + 1, in_width - 1)];
+        output[2 * i] = (uint16_t) ((3 * input[i] + left + 2) >> 2);
+        output[2 * i + 1] = (uint16_t) ((3 * input[i] + right + 2) >> 2);
+    }
+}
+
+void upsample_row_h2v2_16(const uint16_t *near, const uint16_t *far, int in_width, uint16_t *output) {
+    int i;
+    for (i = 0; i < in_width; ++i) {
+        int center = 3 * near[i] + far[i];
+        int left = 3 * near[MAX(i - 1, 0)] + far[MAX(i - 1, 0)];
+        int right = 3 * near[MIN(i + 1, in_width - 1)] + far[MIN(i + 1, in_width - 1)];
+        output[2 * i] = (uint16_t) ((3 * center + left + 8) >> 4);
+        output[2 * i + 1] = (uint16_t) ((3 * center + right + 8) >> 4);
+    }
+}
+
+/*
+ * upscale_row() of the 16-bit samples, scratch must hold get_upscale_scratch_size_16() bytes.
+ */
+void upscale_row_16(const upscale_tables *tables, const uint16_t *input, int row, int32_t *scratch,
+                    uint16_t *output, uint16_t max_value) {
+    uint16_t in_width = tables->in_width;
+    uint16_t in_height = tables->in_height;
+    const uint16_t *top, *bottom;
+    int32_t top_row, top_weight, bottom_weight;
+    int i;
+
+    if (tables->out_width == 2 * in_width && tables->out_height == in_height) {
+        upsample_row_h2_16(get_input_row_16(tables, input, row), in_width, output);
+        return;
+    }
+    if ((tables->out_width == 2 * in_width || tables->out_width == in_width) && tables->out_height == 2 * in_height) {
+        const uint16_t *near = get_input_row_16(tables, input, row / 2);
+        const uint16_t *far = get_input_row_16(tables, input,
+                                               (row & 1) ? MIN(row / 2 + 1, in_height - 1) : MAX(row / 2 - 1, 0));
+        if (tables->out_width == in_width) {
+            for (i = 0; i < in_width; ++i) {
+                output[i] = (uint16_t) ((3 * near[i] + far[i] + 2) >> 2);
+            }
+        } else {
+            upsample_row_h2v2_16(near, far, in_width, output);
+        }
+        return;
+    }
+
+    top_row = tables->row_indexes[row];
+    bottom_weight = tables->row_weights[row];
+    top_weight = (1 << ROW_WEIGHT_BITS) - bottom_weight;
+    top = get_input_row_16(tables, input, top_row);
+    bottom = get_input_row_16(tables, input, bottom_weight != 0 ? top_row + 1 : top_row);
+    for (i = 0; i < in_width; ++i) {
+        scratch[i] = top[i] * top_weight + bottom[i] * bottom_weight;
+    }
+    scratch[in_width] = scratch[in_width - 1];
+    for (i = 0; i < tables->out_width; ++i) {
+        int32_t index = tables->column_indexes[i];
+        int32_t weight = tables->column_weights[i] >> 16;
+        int32_t sum = scratch[index] * ((1 << COLUMN_WEIGHT_BITS) - weight) + scratch[index + 1] * weight;
+        output[i] = (uint16_t) CLIP(0, (sum + UPSCALE_ROUNDING) >> (ROW_WEIGHT_BITS + COLUMN_WEIGHT_BITS), max_value);
     }
 }
 